@@ -101,6 +101,9 @@ secret = ${AMI_SECRET}
 read = system,call,log,verbose,command,agent,user,dtmf,reporting,cdr,dialplan
 write = system,call,command,agent,user,dtmf,reporting,dialplan
 permit = ${AMI_PERMIT_CIDR}
+; CALL_DIR rides on every channel event, so the VarSet flood is not needed
+channelvars = CALL_DIR
+eventfilter = !Event: VarSet
 EOF
 
   echo "[*] AMI user [${AMI_USER}] written to manager_custom.conf"
@@ -159,6 +162,9 @@ SUPERVISOR_ENDPOINT=${SUPERVISOR_ENDPOINT}
 SUPERVISOR_CONTEXT=${SUPERVISOR_CONTEXT}
 SUPERVISOR_PREFIX=${SUPERVISOR_PREFIX}
 ORIGINATE_TIMEOUT_MS=20000
+
+# Comma-separated channel name fragments treated as trunks for direction classification
+TRUNK_PREFIXES=PJSIP/trunk,PJSIP/siptrunk,PJSIP/provider
 EOF
 
   chmod 0640 "${CONF_FILE}"
@@ -181,6 +187,7 @@ Wants=asterisk.service
 Type=simple
 EnvironmentFile=${CONF_FILE}
 ExecStart=${BIN_PATH} \${AMI_HOST} \${AMI_PORT} \${AMI_USER} \${AMI_SECRET}
+ExecReload=/bin/kill -HUP \$MAINPID
 Restart=on-failure
 RestartSec=2
 User=root
@@ -213,6 +220,10 @@ summary() {
   echo "Next step: manually add the supervisor context (copy/paste file provided) and connect it in FreePBX."
   echo "Then reload: fwconsole reload"
   echo
+  echo "Optional: set 'timestampevents = yes' in the [general] section of manager.conf so call"
+  echo "durations use PBX time and the monitor can report its event lag. FreePBX generates that"
+  echo "file, so check it is still set after a reload."
+  echo
 }
 
 main() {
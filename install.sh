@@ -86,11 +86,26 @@ secret = ${AMI_SECRET}
 read = system,call,log,verbose,command,agent,user,dtmf,reporting,cdr,dialplan
 write = system,call,command,agent,user,dtmf,reporting,dialplan
 permit = ${AMI_PERMIT_CIDR}
+; CALL_DIR rides on every channel event, so the VarSet flood is not needed
+channelvars = CALL_DIR
+eventfilter = !Event: VarSet
 EOF
 
   echo "[*] AMI user [${AMI_USER}] configured."
 }
 
+ensure_timestamp_events() {
+  # Timestamp: headers let the monitor time calls by PBX clock and report its event lag
+  echo "[*] Enabling timestampevents in ${ASTERISK_MANAGER}"
+  if grep -qE '^[[:space:]]*timestampevents[[:space:]]*=' "${ASTERISK_MANAGER}"; then
+    sed -i -E 's/^[[:space:]]*timestampevents[[:space:]]*=.*/timestampevents = yes/' "${ASTERISK_MANAGER}"
+  elif grep -qE '^\[general\]' "${ASTERISK_MANAGER}"; then
+    sed -i -E '/^\[general\]/a timestampevents = yes' "${ASTERISK_MANAGER}"
+  else
+    echo "WARNING: no [general] section in ${ASTERISK_MANAGER}; add 'timestampevents = yes' manually."
+  fi
+}
+
 ensure_supervisor_context() {
   echo "[*] Adding supervisor ChanSpy context to ${ASTERISK_EXTENSIONS}"
   backup_file "${ASTERISK_EXTENSIONS}"
@@ -109,11 +124,37 @@ ${begin}
 ; Supervisor monitoring entry point
 ; Dial ${SUPERVISOR_PREFIX}<target> from an authorized supervisor device/context.
 ; Example target: PJSIP/1001-0000002a
+; Variants used by the TUI monitor modes:
+;   ${SUPERVISOR_PREFIX}1<target> = Listen, ${SUPERVISOR_PREFIX}2<target> = Whisper, ${SUPERVISOR_PREFIX}3<target> = Barge
+; The TUI switches an answered supervisor between modes with AMI Redirect;
+; SPY_AUTHED skips the PIN prompt on the second pass.
+; q = quiet. Remove q for beeps if desired.
+exten => _${SUPERVISOR_PREFIX}1.,1,NoOp(Supervisor LISTEN request: \${EXTEN})
+ same => n,ExecIf(\$["\${SPY_AUTHED}" != "1"]?Authenticate(${SUPERVISOR_PIN}))
+ same => n,Set(SPY_AUTHED=1)
+ same => n,Set(TARGET=\${EXTEN:$((${#SUPERVISOR_PREFIX} + 1))})
+ same => n,ChanSpy(\${TARGET},q)
+ same => n,Hangup()
+
+exten => _${SUPERVISOR_PREFIX}2.,1,NoOp(Supervisor WHISPER request: \${EXTEN})
+ same => n,ExecIf(\$["\${SPY_AUTHED}" != "1"]?Authenticate(${SUPERVISOR_PIN}))
+ same => n,Set(SPY_AUTHED=1)
+ same => n,Set(TARGET=\${EXTEN:$((${#SUPERVISOR_PREFIX} + 1))})
+ same => n,ChanSpy(\${TARGET},qw)
+ same => n,Hangup()
+
+exten => _${SUPERVISOR_PREFIX}3.,1,NoOp(Supervisor BARGE request: \${EXTEN})
+ same => n,ExecIf(\$["\${SPY_AUTHED}" != "1"]?Authenticate(${SUPERVISOR_PIN}))
+ same => n,Set(SPY_AUTHED=1)
+ same => n,Set(TARGET=\${EXTEN:$((${#SUPERVISOR_PREFIX} + 1))})
+ same => n,ChanSpy(\${TARGET},qB)
+ same => n,Hangup()
+
+; Backward-compatible single prefix = listen
 exten => _${SUPERVISOR_PREFIX}.,1,NoOp(Supervisor monitor request: \${EXTEN})
  same => n,Authenticate(${SUPERVISOR_PIN})
  same => n,Set(TARGET=\${EXTEN:${#SUPERVISOR_PREFIX}})
  same => n,NoOp(Target: \${TARGET})
-; q = quiet. Remove q for beeps if desired.
  same => n,ChanSpy(\${TARGET},q)
  same => n,Hangup()
 ${end}
@@ -169,6 +210,9 @@ SUPERVISOR_ENDPOINT=${SUPERVISOR_ENDPOINT}
 SUPERVISOR_CONTEXT=${SUPERVISOR_CONTEXT}
 SUPERVISOR_PREFIX=${SUPERVISOR_PREFIX}
 ORIGINATE_TIMEOUT_MS=20000
+
+# Comma-separated channel name fragments treated as trunks for direction classification
+TRUNK_PREFIXES=PJSIP/trunk,PJSIP/siptrunk,PJSIP/provider
 EOF
 
   chmod 0640 "${CONF_FILE}"
@@ -191,6 +235,7 @@ Wants=asterisk.service
 Type=simple
 EnvironmentFile=${CONF_FILE}
 ExecStart=${BIN_PATH} \${AMI_HOST} \${AMI_PORT} \${AMI_USER} \${AMI_SECRET}
+ExecReload=/bin/kill -HUP \$MAINPID
 Restart=on-failure
 RestartSec=2
 
@@ -239,6 +284,7 @@ main() {
   need_root
   install_deps
   ensure_ami_user
+  ensure_timestamp_events
   ensure_supervisor_context
   reload_asterisk
   build_and_install
@@ -21,27 +21,58 @@
 #include <ncursesw/ncurses.h>
 
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <charconv>
 #include <chrono>
+#include <condition_variable>
 #include <csignal>
 #include <cstdlib>
 #include <ctime>
 #include <deque>
+#include <functional>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <list>
 #include <map>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
+#include <new>
+#include <future>
 #include <optional>
 #include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 using boost::asio::ip::tcp;
 
 static std::atomic_bool g_running{true};
+static std::atomic_bool g_reload{false}; // set by SIGHUP, consumed by the UI loop
+
+// Heap allocations made by the calling thread, sampled around the event path for the stats view
+// and --alloc-selftest. Only counted in diagnostic builds (-DCALLMON_COUNT_ALLOCS), which replace
+// operator new; otherwise it stays 0 and the stats view leaves the counts out. Build those with
+// -fno-builtin-free: GCC otherwise pairs the inlined free() below with new-expressions and warns
+// (-Wmismatched-new-delete), although malloc/free is the matching pair here.
+static thread_local uint64_t t_heap_allocs = 0;
+
+#ifdef CALLMON_COUNT_ALLOCS
+void* operator new(std::size_t n) {
+  t_heap_allocs++;
+  if (void* p = std::malloc(n ? n : 1)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#endif
 
 static inline std::string trim(std::string s) {
   auto notSpace = [](int ch) { return !std::isspace(ch); };
@@ -50,20 +81,30 @@ static inline std::string trim(std::string s) {
   return s;
 }
 
-static inline std::string lower(std::string s) {
+static inline std::string_view trim_view(std::string_view s) {
+  while (!s.empty() && std::isspace((unsigned char)s.front())) s.remove_prefix(1);
+  while (!s.empty() && std::isspace((unsigned char)s.back())) s.remove_suffix(1);
+  return s;
+}
+
+static inline std::string lower(std::string_view v) {
+  std::string s(v);
   std::transform(s.begin(), s.end(), s.begin(),
                  [](unsigned char c) { return std::tolower(c); });
   return s;
 }
 
-static inline int to_int_safe(const std::string& s) {
-  try {
-    return std::stoi(s);
-  } catch (...) {
-    return 0;
-  }
+// Leading integer of s like std::stoi, 0 if there is none or it overflows. Does not allocate.
+static inline int to_int_safe(std::string_view s) {
+  while (!s.empty() && std::isspace((unsigned char)s.front())) s.remove_prefix(1);
+  if (!s.empty() && s.front() == '+') s.remove_prefix(1);
+  int v = 0;
+  auto r = std::from_chars(s.data(), s.data() + s.size(), v);
+  return r.ec == std::errc() ? v : 0;
 }
 
+static inline int to_int_safe(const std::string& s) { return to_int_safe(std::string_view(s)); }
+
 static inline std::string now_ts() {
   auto t = std::time(nullptr);
   std::tm tm{};
@@ -73,8 +114,201 @@ static inline std::string now_ts() {
   return oss.str();
 }
 
+// Headers live in a memory resource chosen by whoever builds the message: the reader parses into
+// a scratch arena and the queued copy goes to the batch arena (see EventBatch). Copies made with
+// the plain copy constructor, e.g. for action replies, use the default heap.
 struct AmiMessage {
-  std::unordered_map<std::string, std::string> kv;
+  AmiMessage() = default;
+  explicit AmiMessage(std::pmr::memory_resource* mr) : kv(mr) {}
+  AmiMessage(const AmiMessage& o, std::pmr::memory_resource* mr)
+      : kv(o.kv, mr), received(o.received), at(o.at), stamped(o.stamped) {}
+  AmiMessage(const AmiMessage&) = default;
+  AmiMessage(AmiMessage&&) = default;
+  AmiMessage& operator=(const AmiMessage&) = default;
+  AmiMessage& operator=(AmiMessage&&) = default;
+
+  std::pmr::unordered_map<std::pmr::string, std::pmr::string> kv;
+  std::chrono::steady_clock::time_point received; // when the reader finished parsing it
+  // When Asterisk raised it, from the Timestamp header (manager.conf timestampevents=yes) mapped
+  // onto the steady clock; equal to `received` without the header
+  std::chrono::steady_clock::time_point at;
+  bool stamped = false;
+};
+
+// Latency histogram with fixed power-of-two microsecond buckets: bucket b holds [2^(b-1), 2^b) us,
+// bucket 0 holds 0us, the last one everything from ~18 minutes up. No allocation after construction.
+struct LatencyHistogram {
+  static constexpr int kBuckets = 32;
+  std::array<uint64_t, kBuckets> buckets{};
+  uint64_t count = 0;
+  uint64_t sum_us = 0;
+  uint64_t max_us = 0;
+
+  void add(uint64_t us) {
+    int b = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    buckets[std::min(b, kBuckets - 1)]++;
+    count++;
+    sum_us += us;
+    max_us = std::max(max_us, us);
+  }
+
+  uint64_t mean_us() const { return count ? sum_us / count : 0; }
+
+  void merge(const LatencyHistogram& o) {
+    for (int b = 0; b < kBuckets; b++) buckets[b] += o.buckets[b];
+    count += o.count;
+    sum_us += o.sum_us;
+    max_us = std::max(max_us, o.max_us);
+  }
+
+  // Upper bound of the bucket holding the p-th percentile (0-100), capped at the observed max
+  uint64_t percentile_us(double p) const {
+    if (count == 0) return 0;
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)count);
+    if (rank >= count) rank = count - 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < kBuckets; b++) {
+      seen += buckets[b];
+      if (seen > rank) return std::min<uint64_t>(b == 0 ? 0 : (1ULL << b) - 1, max_us);
+    }
+    return max_us;
+  }
+};
+
+// Histogram over roughly the last one to two spans: samples go into `cur`, which becomes `prev`
+// once it has covered a span. Two fixed histograms, so still no allocation.
+struct RollingHistogram {
+  LatencyHistogram cur;
+  LatencyHistogram prev;
+  std::chrono::steady_clock::time_point cur_start = std::chrono::steady_clock::now();
+
+  void rotate(std::chrono::steady_clock::time_point now, std::chrono::seconds span) {
+    if (now - cur_start < span) return;
+    prev = now - cur_start < 2 * span ? cur : LatencyHistogram{};
+    cur = {};
+    cur_start = now;
+  }
+  void add(uint64_t us, std::chrono::steady_clock::time_point now, std::chrono::seconds span) {
+    rotate(now, span);
+    cur.add(us);
+  }
+  LatencyHistogram merged() const {
+    LatencyHistogram h = prev;
+    h.merge(cur);
+    return h;
+  }
+};
+
+// Fixed-capacity ring of the most recent N samples, oldest first
+template <typename T, size_t N>
+struct Ring {
+  std::array<T, N> v{};
+  size_t head = 0; // next write position
+  size_t size = 0;
+
+  void push(T x) {
+    v[head] = x;
+    head = (head + 1) % N;
+    if (size < N) size++;
+  }
+  const T& at(size_t i) const { return v[(head + N - size + i) % N]; }
+  const T& back() const { return at(size - 1); }
+};
+
+// Event count over a sliding window of `buckets` x `width`, kept as a ring of per-bucket counts
+// plus a running total. Expired buckets are subtracted as time moves on, so add() and sum() are
+// O(1) amortized.
+class SlidingCounter {
+public:
+  SlidingCounter(size_t buckets, std::chrono::seconds width) : counts_(buckets, 0), width_(width) {}
+
+  void add(std::chrono::steady_clock::time_point now, uint64_t n = 1) {
+    advance(now);
+    counts_[cur_ % counts_.size()] += n;
+    total_ += n;
+  }
+  uint64_t sum(std::chrono::steady_clock::time_point now) {
+    advance(now);
+    return total_;
+  }
+  std::chrono::seconds span() const { return width_ * (int)counts_.size(); }
+
+private:
+  void advance(std::chrono::steady_clock::time_point now) {
+    int64_t b = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count() / width_.count();
+    if (b <= cur_) return;
+    // Clear the buckets the window slid past, at most one full turn
+    int64_t from = std::max(cur_ + 1, b - (int64_t)counts_.size() + 1);
+    for (int64_t i = from; i <= b; i++) {
+      uint64_t& c = counts_[i % counts_.size()];
+      total_ -= c;
+      c = 0;
+    }
+    if (b - cur_ >= (int64_t)counts_.size()) total_ = 0;
+    cur_ = b;
+  }
+
+  std::vector<uint64_t> counts_;
+  std::chrono::seconds width_;
+  int64_t cur_ = 0;
+  uint64_t total_ = 0;
+};
+
+static std::string fmt_us(uint64_t us) {
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(1);
+  if (us < 1000) oss << us << "us";
+  else if (us < 1000000) oss << us / 1000.0 << "ms";
+  else oss << us / 1000000.0 << "s";
+  return oss.str();
+}
+
+// One entry of a channel's recent history. Fixed size, so recording it never allocates.
+struct ChanEvent {
+  std::chrono::steady_clock::time_point at;
+  char type[24];
+  char detail[56];
+};
+
+// Events of one call (all channels sharing a Linkedid), stored raw and rendered only when the
+// timeline view asks for it
+struct CallLog {
+  struct Entry {
+    ChanEvent ev;
+    uint8_t chan; // index into channels
+  };
+  std::vector<std::string> channels; // in order of first appearance
+  std::vector<Entry> entries;
+  int live = 0;                      // channels not hung up yet
+  uint32_t dropped = 0;              // past kMaxEntries
+  std::chrono::steady_clock::time_point ended = std::chrono::steady_clock::time_point::min();
+  std::chrono::steady_clock::time_point last_event; // for idle expiry
+  static constexpr size_t kMaxEntries = 512;
+};
+
+// Per-channel rings of the last kDepth events, carved out of one pooled arena of slots. A channel
+// takes a slot on its first event and gives it back at Hangup, so memory is bounded by the peak
+// number of live channels and freed slots are reused without going back to the allocator.
+struct ChanHistoryPool {
+  static constexpr uint32_t kNone = UINT32_MAX;
+  static constexpr size_t kDepth = 16;
+  std::vector<Ring<ChanEvent, kDepth>> slots;
+  std::vector<uint32_t> free;
+
+  uint32_t acquire() {
+    if (free.empty()) {
+      slots.emplace_back();
+      return (uint32_t)slots.size() - 1;
+    }
+    uint32_t id = free.back();
+    free.pop_back();
+    slots[id].head = slots[id].size = 0;
+    return id;
+  }
+  void release(uint32_t id) {
+    if (id != kNone) free.push_back(id);
+  }
+  size_t live() const { return slots.size() - free.size(); }
 };
 
 struct ChannelInfo {
@@ -93,6 +327,24 @@ struct ChannelInfo {
   std::string peer;      // endpoint/trunk best effort
   std::string call_dir;  // inbound/outbound/internal/unknown (optional from dialplan var)
   std::string bridge_id;
+  std::string queue;     // last queue joined (QueueCallerJoin), kept after the caller is connected
+  std::string rec;       // ""|recording|paused, from MixMonitor events
+
+  // Audio formats from Getvar CHANNEL(audio*format), fetched once after the channel is first bridged
+  std::string fmt_native;
+  std::string fmt_read;
+  std::string fmt_write;
+  bool fmt_queued = false;
+
+  uint32_t history = ChanHistoryPool::kNone; // slot in StateStore::history
+
+  // Dialplan profiler: step this channel is executing and when its Newexten arrived
+  std::string step;
+  std::chrono::steady_clock::time_point step_at;
+
+  // Cached classification, refreshed when metadata changes or trunk prefixes are reloaded
+  bool is_trunk = false;
+  std::string dir = "unknown";
 
   std::chrono::steady_clock::time_point created = std::chrono::steady_clock::now();
   std::chrono::steady_clock::time_point last_update = std::chrono::steady_clock::now();
@@ -106,12 +358,32 @@ struct BridgeInfo {
   std::chrono::steady_clock::time_point last_update = std::chrono::steady_clock::now();
 };
 
+// One Asterisk node to monitor. Nodes share the AMI credentials.
+struct AmiNodeConfig {
+  std::string name;
+  std::string host;
+  int port = 5038;
+
+  bool operator==(const AmiNodeConfig& o) const { return name == o.name && host == o.host && port == o.port; }
+  bool operator!=(const AmiNodeConfig& o) const { return !(*this == o); }
+};
+
 struct AppConfig {
   std::string ami_host = "127.0.0.1";
   int ami_port = 5038;
   std::string ami_user;
   std::string ami_secret;
 
+  // Second AMI login with Events: off used only for actions, so responses don't queue behind events
+  bool ami_action_conn = false;
+  int action_timeout_ms = 5000;
+  int bulk_window = 64; // max outstanding ActionIDs per bulk job
+  double action_rate = 0;   // actions/s per node, 0 = unlimited
+  double action_burst = 50; // token bucket depth
+
+  // Multi-PBX: name@host[:port] entries. Empty means a single node at ami_host:ami_port.
+  std::vector<AmiNodeConfig> nodes;
+
   // Supervisor originate (optional)
   std::string supervisor_endpoint = ""; // e.g. "PJSIP/9000"
   std::string supervisor_context  = "supervisor-monitor";
@@ -120,178 +392,81 @@ struct AppConfig {
 
   // Heuristic trunk/extension detection
   std::vector<std::string> trunk_prefixes = {"PJSIP/trunk", "PJSIP/siptrunk", "PJSIP/provider"};
-};
 
-class AmiClient {
-public:
-  AmiClient(boost::asio::io_context& io, AppConfig cfg)
-      : io_(io), socket_(io), cfg_(std::move(cfg)) {}
+  // Peers (e.g. "provider" for PJSIP/provider-0000001b) whose calls are dropped on sight
+  std::vector<std::string> quarantine_trunks;
 
-  void connect() {
-    tcp::resolver resolver(io_);
-    auto endpoints = resolver.resolve(cfg_.ami_host, std::to_string(cfg_.ami_port));
-    boost::asio::connect(socket_, endpoints);
+  // QA sampling: share of answered calls offered to the supervisor pool, 0 = off.
+  // Per-stratum overrides keyed by trunk prefix, "queue:<name>" or "internal".
+  double qa_sample_percent = 0;
+  std::map<std::string, double> qa_strata_percent;
+  std::vector<std::string> qa_supervisors; // empty = SUPERVISOR_ENDPOINT alone
+  int qa_max_concurrent = 0;               // 0 = one per pool supervisor
 
-    // Drain banner (non-blocking small read)
-    boost::system::error_code ec;
-    socket_.non_blocking(true, ec);
-    if (!ec) {
-      for (int i = 0; i < 5; i++) {
-        char buf[1024];
-        socket_.read_some(boost::asio::buffer(buf), ec);
-        if (ec) break;
-      }
-    }
-    socket_.non_blocking(false, ec);
-  }
+  // Fetch bridged channels' audio formats to flag transcoding (3 Getvar actions per channel)
+  bool codec_detect = false;
 
-  bool login() {
-    std::ostringstream oss;
-    oss << "Action: Login\r\n"
-        << "Username: " << cfg_.ami_user << "\r\n"
-        << "Secret: " << cfg_.ami_secret << "\r\n"
-        << "Events: on\r\n"
-        << "\r\n";
-    write_raw(oss.str());
+  // Poll "core show taskprocessors" every N seconds, 0 = off (needs the "command" write class)
+  int taskproc_sample_sec = 0;
+  int taskproc_alert_depth = 50; // queue depth that raises an alert
 
-    auto msg = read_message_blocking();
-    if (!msg) return false;
-    auto it = msg->kv.find("Response");
-    if (it == msg->kv.end()) return false;
-    return lower(it->second) == "success";
-  }
+  // Action: Ping every ping_interval_sec (0 = off); ping_misses unanswered in a row drop and
+  // reconnect the connection
+  int ping_interval_sec = 5;
+  int ping_misses = 3;
 
-  void logoff() {
-    write_raw("Action: Logoff\r\n\r\n");
-  }
-
-  // Read loop: pushes parsed AMI messages into the queue
-  void start_reader(std::deque<AmiMessage>* out_queue, std::mutex* out_mu) {
-    reader_thread_ = std::thread([this, out_queue, out_mu]() {
-      while (g_running.load()) {
-        try {
-          auto msgOpt = read_message_blocking();
-          if (!msgOpt) continue;
-          {
-            std::lock_guard<std::mutex> lk(*out_mu);
-            out_queue->push_back(std::move(*msgOpt));
-            if (out_queue->size() > 20000) out_queue->pop_front();
-          }
-        } catch (...) {
-          // socket error, break to allow restart logic (not implemented in this minimal version)
-          break;
-        }
-      }
-    });
-  }
+  // Resync channels with CoreShowChannels after lost events, at most every resync_min_sec.
+  // Sequence gaps only count as loss when seq_gap_resync is set (AMI user with full, unfiltered read).
+  bool seq_gap_resync = false;
+  int resync_min_sec = 30;
 
-  void stop_reader() {
-    if (reader_thread_.joinable()) reader_thread_.join();
-  }
+  int queue_sl_sec = 20; // service level: share of answered calls picked up within this many seconds
 
-  // Actions
-  bool hangup_channel(const std::string& channel) {
-    std::ostringstream oss;
-    oss << "Action: Hangup\r\n"
-        << "Channel: " << channel << "\r\n\r\n";
-    write_raw(oss.str());
-    auto msg = read_message_blocking();
-    return msg && lower(msg->kv["Response"]) == "success";
-  }
+  // A failure-type hangup cause spikes at this many per minute on one trunk and direction,
+  // when that is also three times its rate over the preceding 14 minutes
+  int cause_spike_min = 5;
 
-  bool bridge_kick(const std::string& bridge_id, const std::string& channel) {
-    // Asterisk 20 supports BridgeKick
-    std::ostringstream oss;
-    oss << "Action: BridgeKick\r\n"
-        << "BridgeUniqueid: " << bridge_id << "\r\n"
-        << "Channel: " << channel << "\r\n\r\n";
-    write_raw(oss.str());
-    auto msg = read_message_blocking();
-    return msg && lower(msg->kv["Response"]) == "success";
-  }
+  // Time dialplan steps from consecutive Newexten events (needs the AMI user's "dialplan" read class)
+  bool dialplan_profile = false;
 
-  bool bridge_destroy(const std::string& bridge_id) {
-    // More deterministic than hanging up one channel when you want the entire bridge ended
-    std::ostringstream oss;
-    oss << "Action: BridgeDestroy\r\n"
-        << "BridgeUniqueid: " << bridge_id << "\r\n\r\n";
-    write_raw(oss.str());
-    auto msg = read_message_blocking();
-    return msg && lower(msg->kv["Response"]) == "success";
-  }
+  // MixMonitor recordings started from the TUI. Relative paths land in Asterisk's monitor dir.
+  std::string recording_dir;
+  std::string recording_format = "wav";
+  std::string recording_options; // MixMonitor options, e.g. "b" to record only while bridged
 
-  bool originate_supervisor_chanspy(const std::string& target_channel) {
-    if (cfg_.supervisor_endpoint.empty()) return false;
+  // KEY=VALUE file (same format as the systemd EnvironmentFile), re-read on SIGHUP
+  std::string config_file = "/etc/ami-callmon/config.env";
+  // Environment values that differ from the file, and command line host/port/user/secret, as
+  // config keys. Applied after the file in this order, at startup and on every reload.
+  std::vector<std::pair<std::string, std::string>> env_overrides;
+  std::vector<std::pair<std::string, std::string>> cli_overrides;
+};
 
-    // Dialplan expects extension like *55<target>, in supervisor-monitor context.
-    // Example: exten "*55PJSIP/1001-0000002a"
-    std::string exten = cfg_.supervisor_prefix + target_channel;
+// Holds the current immutable config snapshot. Readers grab a shared_ptr and use it for the
+// whole operation; a reload publishes a new snapshot, so nothing ever sees a half-applied config.
+class ConfigStore {
+public:
+  explicit ConfigStore(AppConfig cfg) : cur_(std::make_shared<const AppConfig>(std::move(cfg))) {}
 
-    std::ostringstream oss;
-    oss << "Action: Originate\r\n"
-        << "Channel: " << cfg_.supervisor_endpoint << "\r\n"
-        << "Context: " << cfg_.supervisor_context << "\r\n"
-        << "Exten: " << exten << "\r\n"
-        << "Priority: 1\r\n"
-        << "Timeout: " << cfg_.originate_timeout_ms << "\r\n"
-        << "Async: true\r\n\r\n";
-    write_raw(oss.str());
-    auto msg = read_message_blocking();
-    return msg && lower(msg->kv["Response"]) == "success";
+  std::shared_ptr<const AppConfig> get() const { return std::atomic_load(&cur_); }
+  void publish(AppConfig cfg) {
+    std::atomic_store(&cur_, std::shared_ptr<const AppConfig>(std::make_shared<const AppConfig>(std::move(cfg))));
   }
 
 private:
-  void write_raw(const std::string& s) {
-    boost::asio::write(socket_, boost::asio::buffer(s));
-  }
-
-  std::optional<AmiMessage> read_message_blocking() {
-    AmiMessage msg;
-    while (true) {
-      std::string line = read_line_crlf();
-      if (line.empty()) {
-        if (!msg.kv.empty()) return msg;
-        continue;
-      }
-      auto pos = line.find(':');
-      if (pos == std::string::npos) continue;
-      std::string k = trim(line.substr(0, pos));
-      std::string v = trim(line.substr(pos + 1));
-      msg.kv[k] = v;
-    }
-  }
-
-  std::string read_line_crlf() {
-    boost::asio::streambuf sb;
-    boost::asio::read_until(socket_, sb, "\r\n");
-    std::istream is(&sb);
-    std::string line;
-    std::getline(is, line);
-    if (!line.empty() && line.back() == '\r') line.pop_back();
-    return line;
-  }
-
-  boost::asio::io_context& io_;
-  tcp::socket socket_;
-  AppConfig cfg_;
-  std::thread reader_thread_;
+  std::shared_ptr<const AppConfig> cur_;
 };
 
-// --- State Store ---
-struct StateStore {
-  std::unordered_map<std::string, ChannelInfo> channels_by_name; // key=Channel
-  std::unordered_map<std::string, std::string> chan_by_uniqueid; // uniqueid -> Channel
-  std::unordered_map<std::string, BridgeInfo> bridges;           // bridge_id -> bridge info
-  std::deque<std::string> audit_log;                             // last N actions/events of interest
-  std::string filter = "all"; // all|inbound|outbound|internal
-  int selected_bridge_index = 0;
-  int selected_member_index = 0;
+// ChanSpy variant in the supervisor-monitor context: <prefix>1 listen, 2 whisper, 3 barge
+static std::string spy_exten(const AppConfig& cfg, const std::string& mode, const std::string& target_channel) {
+  const char* digit = mode == "whisper" ? "2" : mode == "barge" ? "3" : "1";
+  return cfg.supervisor_prefix + digit + target_channel;
+}
 
-  void log_line(const std::string& s) {
-    audit_log.push_back(now_ts() + "  " + s);
-    while (audit_log.size() > 2000) audit_log.pop_front();
-  }
-};
+static std::vector<AmiNodeConfig> effective_nodes(const AppConfig& cfg) {
+  if (!cfg.nodes.empty()) return cfg.nodes;
+  return {AmiNodeConfig{cfg.ami_host, cfg.ami_host, cfg.ami_port}};
+}
 
 static void parse_tech_peer(const std::string& channel, std::string& tech, std::string& peer) {
   // Examples:
@@ -305,429 +480,4349 @@ static void parse_tech_peer(const std::string& channel, std::string& tech, std::
   peer = (dash == std::string::npos) ? rest : rest.substr(0, dash);
 }
 
-static std::string classify_dir_heuristic(const ChannelInfo& c, const AppConfig& cfg) {
-  // If dialplan sets CALL_DIR, prefer it
-  if (!c.call_dir.empty()) return lower(c.call_dir);
+// Events read since the UI loop last drained the node. Queued messages are copied into a monotonic
+// arena that is rewound in one step once the batch has been applied, instead of freeing every
+// header string and map node on its own. The arena starts on a buffer that grows to fit the
+// largest batch seen, so a steady event rate is absorbed without going to the heap at all.
+// Guarded by PbxNode::q_mu.
+class EventBatch {
+public:
+  EventBatch() : buf_(kMinBuffer), parsed_(60, std::chrono::seconds(1)), parse_allocs_(60, std::chrono::seconds(1)),
+                 applied_(60, std::chrono::seconds(1)), apply_allocs_(60, std::chrono::seconds(1)) {
+    rewind();
+  }
+  EventBatch(const EventBatch&) = delete;
+  EventBatch& operator=(const EventBatch&) = delete;
 
-  // Heuristic:
-  // - Trunk-like channel names are inbound/outbound depending on context/exten and connected/caller
-  // - Internal if peer looks numeric extension and context suggests internal
-  // This is best-effort. For accuracy, set __CALL_DIR in dialplan at entry.
+  void push(const AmiMessage& m) { q_->emplace_back(m, &*arena_); }
+  size_t size() const { return q_->size(); }
+  const std::pmr::deque<AmiMessage>& messages() const { return *q_; }
 
-  std::string ch = c.channel;
-  std::string lch = lower(ch);
+  // Keep at most max messages by dropping the oldest. Dropped messages hold their arena space
+  // until the next reset, so once a full queue's worth has gone the survivors are copied into a
+  // rewound arena. Returns how many were dropped.
+  size_t trim(size_t max) {
+    if (q_->size() <= max) return 0;
+    size_t n = q_->size() - max;
+    for (size_t i = 0; i < n; i++) q_->pop_front();
+    dropped_ += n;
+    if (dropped_ > max) compact();
+    return n;
+  }
 
-  bool is_trunk = false;
-  for (const auto& p : cfg.trunk_prefixes) {
-    if (lch.find(lower(p)) != std::string::npos) { is_trunk = true; break; }
+  // Drop every message and rewind the arena; a batch that spilled past the buffer grows it
+  void reset() {
+    q_.reset();
+    arena_.reset();
+    if (spill_.bytes && buf_.size() < kMaxBuffer) {
+      size_t n = buf_.size();
+      while (n < buf_.size() + spill_.bytes && n < kMaxBuffer) n *= 2;
+      buf_ = std::vector<std::byte>(n);
+      grows_++;
+    }
+    rewind();
   }
 
-  // Internal extension guess: peer is digits and not obviously trunk
-  bool peer_digits = !c.peer.empty() && std::all_of(c.peer.begin(), c.peer.end(), ::isdigit);
+  // Heap allocations per event over the last minute, on the reader side (parse, response and
+  // sequence checks, the copy into the batch) and the UI side (apply_event)
+  void note_parsed(uint64_t allocs, std::chrono::steady_clock::time_point now) {
+    parsed_.add(now);
+    parse_allocs_.add(now, allocs);
+  }
+  void note_applied(size_t events, uint64_t allocs, std::chrono::steady_clock::time_point now) {
+    applied_.add(now, events);
+    apply_allocs_.add(now, allocs);
+  }
+  double parse_allocs_per_event(std::chrono::steady_clock::time_point now) {
+    uint64_t n = parsed_.sum(now);
+    return n ? (double)parse_allocs_.sum(now) / n : 0;
+  }
+  double apply_allocs_per_event(std::chrono::steady_clock::time_point now) {
+    uint64_t n = applied_.sum(now);
+    return n ? (double)apply_allocs_.sum(now) / n : 0;
+  }
+  size_t arena_bytes() const { return buf_.size(); }
+  uint64_t arena_grows() const { return grows_; }
 
-  if (is_trunk) {
-    // If caller looks like PSTN and connected looks like extension, likely inbound
-    bool conn_is_ext = !c.connected_num.empty() && std::all_of(c.connected_num.begin(), c.connected_num.end(), ::isdigit) && c.connected_num.size() <= 6;
-    bool caller_is_ext = !c.caller_num.empty() && std::all_of(c.caller_num.begin(), c.caller_num.end(), ::isdigit) && c.caller_num.size() <= 6;
-    if (conn_is_ext && !caller_is_ext) return "inbound";
-    if (caller_is_ext && !conn_is_ext) return "outbound";
-    return "unknown";
+private:
+  static constexpr size_t kMinBuffer = 64 * 1024;
+  static constexpr size_t kMaxBuffer = 16 * 1024 * 1024;
+
+  // Upstream of the arena: what a batch takes beyond the buffer, which sizes the next buffer
+  struct Spill : std::pmr::memory_resource {
+    size_t bytes = 0;
+    void* do_allocate(size_t n, size_t align) override {
+      bytes += n;
+      return std::pmr::new_delete_resource()->allocate(n, align);
+    }
+    void do_deallocate(void* p, size_t n, size_t align) override {
+      std::pmr::new_delete_resource()->deallocate(p, n, align);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& o) const noexcept override { return this == &o; }
+  };
+
+  void compact() {
+    std::vector<AmiMessage> keep;
+    keep.reserve(q_->size());
+    for (const auto& m : *q_) keep.emplace_back(m, std::pmr::new_delete_resource());
+    reset();
+    for (const auto& m : keep) push(m);
   }
 
-  if (peer_digits) return "internal";
-  return "unknown";
+  void rewind() {
+    spill_.bytes = 0;
+    dropped_ = 0;
+    arena_.emplace(buf_.data(), buf_.size(), &spill_);
+    q_.emplace(&*arena_);
+  }
+
+  std::vector<std::byte> buf_;
+  Spill spill_;
+  std::optional<std::pmr::monotonic_buffer_resource> arena_;
+  std::optional<std::pmr::deque<AmiMessage>> q_; // allocated from arena_, so destroyed before it
+  size_t dropped_ = 0;
+  uint64_t grows_ = 0;
+  SlidingCounter parsed_;
+  SlidingCounter parse_allocs_;
+  SlidingCounter applied_;
+  SlidingCounter apply_allocs_;
+};
+
+// One TCP session to the manager interface. Writes are serialized by write_mu; only one thread reads.
+struct AmiConn {
+  explicit AmiConn(boost::asio::io_context& io) : socket(io) {}
+
+  tcp::socket socket;
+  boost::asio::streambuf rbuf; // persists across reads: read_until may pull in more than one line
+  std::string line;            // current line, reused so reading does not allocate
+  std::mutex write_mu;
+};
+
+// An action to send. ActionID is assigned by AmiClient when it is written.
+struct AmiAction {
+  std::string name;
+  std::vector<std::pair<std::string, std::string>> headers;
+};
+
+// Latency of one action type: write -> Response, and write -> event showing the effect.
+// no_effect counts actions whose effect was not seen within a minute.
+struct ActionLatency {
+  LatencyHistogram response;
+  LatencyHistogram effect;
+  uint64_t no_effect = 0;
+};
+
+// The event that shows an action took effect, as "<Event>|<Channel or bridge>", or "" for
+// actions without one. effect_event_key() builds the same key from the event side.
+static std::string effect_key(const AmiAction& a) {
+  auto header = [&](const char* k) -> std::string {
+    for (const auto& [hk, hv] : a.headers) {
+      if (hk == k) return hv;
+    }
+    return "";
+  };
+  if (a.name == "Hangup") return "Hangup|" + header("Channel");
+  if (a.name == "BridgeKick") return "BridgeLeave|" + header("Channel");
+  if (a.name == "BridgeDestroy") return "BridgeDestroy|" + header("BridgeUniqueid");
+  if (a.name == "MixMonitor") return "MixMonitorStart|" + header("Channel");
+  if (a.name == "StopMixMonitor") return "MixMonitorStop|" + header("Channel");
+  if (a.name == "MixMonitorMute") return "MixMonitorMute|" + header("Channel");
+  return "";
 }
 
-static int secs_since(std::chrono::steady_clock::time_point t0) {
-  if (t0 == std::chrono::steady_clock::time_point::min()) return 0;
-  auto now = std::chrono::steady_clock::now();
-  return (int)std::chrono::duration_cast<std::chrono::seconds>(now - t0).count();
+static std::string effect_event_key(const AmiMessage& m) {
+  auto ev = m.kv.find("Event");
+  if (ev == m.kv.end()) return "";
+  std::string_view e = ev->second;
+  const char* id = e == "BridgeDestroy" ? "BridgeUniqueid"
+                   : (e == "Hangup" || e == "BridgeLeave" || e.rfind("MixMonitor", 0) == 0) ? "Channel"
+                   : nullptr;
+  if (!id) return "";
+  auto it = m.kv.find(id);
+  if (it == m.kv.end()) return "";
+  std::string key(e);
+  key += '|';
+  key += it->second;
+  return key;
 }
 
-static void apply_event(StateStore& st, const AppConfig& cfg, const AmiMessage& m) {
-  auto get = [&](const char* k) -> std::string {
-    auto it = m.kv.find(k);
-    return it == m.kv.end() ? "" : it->second;
-  };
+// Recording actions, shared by the single-channel helpers and bulk jobs.
+// The file is named after the channel's Uniqueid so a recording can be matched to its CDR.
+static AmiAction mixmonitor_action(const AppConfig& cfg, const std::string& channel, const std::string& uniqueid) {
+  std::string file = "callmon-" + (uniqueid.empty() ? std::to_string(std::time(nullptr)) : uniqueid) + "." +
+                     cfg.recording_format;
+  if (!cfg.recording_dir.empty()) file = cfg.recording_dir + "/" + file;
+  AmiAction a{"MixMonitor", {{"Channel", channel}, {"File", file}}};
+  if (!cfg.recording_options.empty()) a.headers.push_back({"Options", cfg.recording_options});
+  return a;
+}
 
-  const std::string event = get("Event");
-  if (event.empty()) return;
+static AmiAction stop_mixmonitor_action(const std::string& channel) {
+  return {"StopMixMonitor", {{"Channel", channel}}};
+}
 
-  // Channel lifecycle and metadata
-  if (event == "Newchannel") {
-    ChannelInfo ci;
-    ci.channel = get("Channel");
-    ci.uniqueid = get("Uniqueid");
-    ci.linkedid = get("Linkedid");
-    ci.caller_num = get("CallerIDNum");
-    ci.caller_name = get("CallerIDName");
-    ci.context = get("Context");
-    ci.exten = get("Exten");
-    ci.channelstate = get("ChannelState");
-    ci.state_desc = get("ChannelStateDesc");
-    parse_tech_peer(ci.channel, ci.tech, ci.peer);
+// PauseMonitor only drives the legacy Monitor() app; MixMonitor is paused by muting both directions
+static AmiAction pause_mixmonitor_action(const std::string& channel, bool pause) {
+  return {"MixMonitorMute", {{"Channel", channel}, {"Direction", "both"}, {"State", pause ? "1" : "0"}}};
+}
 
-    ci.last_update = std::chrono::steady_clock::now();
-    st.channels_by_name[ci.channel] = ci;
-    if (!ci.uniqueid.empty()) st.chan_by_uniqueid[ci.uniqueid] = ci.channel;
-    st.log_line("Newchannel: " + ci.channel);
-    return;
-  }
+// One caller's claim on an in-flight action. Coalesced callers share the ActionID, so a caller
+// that gives up cancels by its own waiter number.
+struct ActionTicket {
+  std::string id;
+  uint64_t waiter = 0;
+};
 
-  if (event == "Rename") {
-    std::string oldn = get("Oldname");
-    std::string newn = get("Newname");
-    if (!oldn.empty() && !newn.empty()) {
-      auto it = st.channels_by_name.find(oldn);
-      if (it != st.channels_by_name.end()) {
-        ChannelInfo ci = it->second;
-        st.channels_by_name.erase(it);
-        ci.channel = newn;
-        parse_tech_peer(ci.channel, ci.tech, ci.peer);
-        st.channels_by_name[newn] = ci;
+// A batch of actions pipelined on one node with at most `window` responses outstanding.
+// Counters are written by the bulk worker and reader threads, read by the UI.
+struct BulkJob {
+  std::string label;
+  int node_index = 0; // owner in the UI's node list, for reporting
+  std::vector<AmiAction> actions;
+  std::atomic<int> sent{0};
+  std::atomic<int> ok{0};
+  std::atomic<int> failed{0};
+  std::atomic_bool done{false};
+  bool reported = false; // UI thread only
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  std::atomic<int64_t> elapsed_ms{0};
 
-        // Update any bridge memberships
-        for (auto& [bid, b] : st.bridges) {
-          if (b.channels.erase(oldn)) b.channels.insert(newn);
-        }
-        st.log_line("Rename: " + oldn + " -> " + newn);
-      }
-    }
-    return;
-  }
+  std::mutex mu;
+  std::condition_variable cv;
+  std::map<size_t, ActionTicket> inflight; // action index -> action awaiting a response
 
-  if (event == "Newstate") {
-    std::string ch = get("Channel");
-    auto it = st.channels_by_name.find(ch);
-    if (it != st.channels_by_name.end()) {
-      it->second.channelstate = get("ChannelState");
-      it->second.state_desc = get("ChannelStateDesc");
-      it->second.last_update = std::chrono::steady_clock::now();
+  int total() const { return (int)actions.size(); }
+};
+
+// Token bucket guarding the action path. Refills at `rate` tokens/s up to `burst`.
+class TokenBucket {
+public:
+  // Take n tokens. When short, waits for the refill unless that would exceed max_wait (then
+  // returns false and takes nothing); a negative max_wait waits as long as needed. force takes
+  // the tokens at once, leaving the bucket in debt, for actions that must never be held back.
+  bool acquire(double rate, double burst, int n, std::chrono::milliseconds max_wait, bool force, bool& waited) {
+    waited = false;
+    if (rate <= 0) return true;
+    std::unique_lock<std::mutex> lk(mu_);
+    refill(rate, burst);
+    double want = std::min<double>(n, burst);
+    if (force || tokens_ >= want) {
+      tokens_ -= n;
+      return true;
     }
-    return;
+    auto wait = std::chrono::microseconds((int64_t)((want - tokens_) / rate * 1e6));
+    if (max_wait.count() >= 0 && wait > max_wait) return false;
+    waited = true;
+    lk.unlock();
+    std::this_thread::sleep_for(wait);
+    lk.lock();
+    refill(rate, burst);
+    tokens_ -= n;
+    return true;
   }
 
-  if (event == "NewCallerid") {
-    std::string ch = get("Channel");
-    auto it = st.channels_by_name.find(ch);
-    if (it != st.channels_by_name.end()) {
-      it->second.caller_num = get("CallerIDNum");
-      it->second.caller_name = get("CallerIDName");
-      it->second.last_update = std::chrono::steady_clock::now();
+private:
+  void refill(double rate, double burst) {
+    auto now = std::chrono::steady_clock::now();
+    if (!primed_) {
+      tokens_ = burst;
+      primed_ = true;
+    } else {
+      tokens_ = std::min(burst, tokens_ + std::chrono::duration<double>(now - last_).count() * rate);
     }
-    return;
+    last_ = now;
   }
 
-  if (event == "VarSet") {
+  std::mutex mu_;
+  double tokens_ = 0;
+  bool primed_ = false;
+  std::chrono::steady_clock::time_point last_;
+};
+
+#ifdef CALLMON_COUNT_ALLOCS
+static int alloc_self_test();
+#endif
+
+class AmiClient {
+#ifdef CALLMON_COUNT_ALLOCS
+  friend int alloc_self_test();
+#endif
+
+public:
+  using ResponseFn = std::function<void(const AmiMessage&)>;
+
+  AmiClient(boost::asio::io_context& io, const ConfigStore& conf, AmiNodeConfig node)
+      : io_(io), ev_(io), conf_(conf), node_(std::move(node)) {}
+
+  const AmiNodeConfig& node() const { return node_; }
+
+  // True when actions travel on their own Events: off connection
+  bool has_action_lane() const { return act_ != nullptr; }
+
+  // Health, readable from the UI thread while the reader runs
+  bool connected() const { return connected_.load(); }
+  uint64_t messages_read() const { return messages_read_.load(); }
+  uint64_t seq_gaps() const { return seq_gaps_.load(); }
+  uint64_t seq_missing() const { return seq_missing_.load(); }
+  uint64_t queue_dropped() const { return queue_dropped_.load(); }
+  uint64_t reconnects() const { return reconnects_.load(); }
+  // True once after events were lost (sequence gap or queue overflow) since the last call
+  bool take_resync_request() { return resync_wanted_.exchange(false); }
+  int secs_since_last_message() const {
+    auto last = last_rx_ms_.load();
+    if (last == 0) return -1;
+    auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return (int)((now - last) / 1000);
+  }
+
+  void connect() {
+    connect_conn(ev_);
+    if (conf_.get()->ami_action_conn) {
+      act_ = std::make_unique<AmiConn>(io_);
+      try {
+        connect_conn(*act_);
+      } catch (...) {
+        act_fallback_.store(true);
+        act_.reset();
+      }
+    }
+  }
+
+  // Logs in the event connection and, if configured, the action connection. A failed action
+  // connection is dropped and actions fall back to the event connection.
+  bool login() {
+    bool ok = login_conn(ev_, true);
+    connected_.store(ok);
+    if (ok && act_) {
+      bool act_ok = false;
+      try {
+        act_ok = login_conn(*act_, false);
+      } catch (...) {
+      }
+      if (!act_ok) {
+        act_fallback_.store(true);
+        act_.reset();
+      }
+    }
+    return ok;
+  }
+
+  // Ingest-time rule: the event reader hangs up any Newchannel on these peers as soon as it is
+  // parsed, without waiting for the UI loop.
+  void set_quarantine(std::set<std::string> peers) {
+    std::atomic_store(&quarantine_, std::shared_ptr<const std::set<std::string>>(
+        std::make_shared<const std::set<std::string>>(std::move(peers))));
+  }
+
+  // Messages from background threads for the audit log; drained by the UI loop
+  std::vector<std::string> drain_notes() {
+    std::lock_guard<std::mutex> lk(notes_mu_);
+    std::vector<std::string> out(notes_.begin(), notes_.end());
+    notes_.clear();
+    return out;
+  }
+
+  // Set when AMI_ACTION_CONN was requested but the action connection could not be logged in
+  bool action_lane_failed() const { return act_fallback_.load(); }
+
+  // Declare the connection dead from any thread (e.g. missed heartbeats on a half-open socket).
+  // The blocked readers fail and the event reader reconnects. Holds write_mu like reopen(), which
+  // may be replacing the socket on the reader thread.
+  void drop_connection() {
+    boost::system::error_code ec;
+    {
+      std::lock_guard<std::mutex> lk(ev_.write_mu);
+      ev_.socket.shutdown(tcp::socket::shutdown_both, ec);
+    }
+    if (act_) {
+      std::lock_guard<std::mutex> lk(act_->write_mu);
+      act_->socket.shutdown(tcp::socket::shutdown_both, ec);
+    }
+  }
+
+  void logoff() {
+    if (act_) {
+      try {
+        write_raw(*act_, "Action: Logoff\r\n\r\n");
+      } catch (...) {
+      }
+    }
+    write_raw(ev_, "Action: Logoff\r\n\r\n");
+  }
+
+  // Read loop: pushes parsed AMI messages into the queue. Responses to our own actions are handed
+  // to the waiting caller instead. With a separate action connection it gets its own reader;
+  // anything on it that is not a response (e.g. EventList entries) joins the same queue.
+  // With reconnect_first (node unreachable at startup) the reader begins in the reconnect/backoff
+  // loop, exactly as after a later drop.
+  void start_reader(EventBatch* batch, std::mutex* batch_mu, bool reconnect_first = false) {
+    reader_thread_ = std::thread([this, batch, batch_mu, reconnect_first]() {
+      if (reconnect_first && !reconnect(batch, batch_mu)) return;
+      read_loop(ev_, batch, batch_mu, true);
+    });
+    if (act_ && !reconnect_first) {
+      action_reader_thread_ = std::thread([this, batch, batch_mu]() {
+        read_loop(*act_, batch, batch_mu, false);
+      });
+    }
+  }
+
+  void stop_reader() {
+    if (reader_thread_.joinable()) reader_thread_.join();
+    if (action_reader_thread_.joinable()) action_reader_thread_.join();
+    std::lock_guard<std::mutex> lk(bulk_mu_);
+    for (auto& [t, job] : bulk_threads_) {
+      if (t.joinable()) t.join();
+    }
+  }
+
+  // Run a bulk job on its own worker thread. Actions are written in batches: the window is filled
+  // in one write, then refilled once half of it has been answered. Responses are counted by the
+  // reader thread; a window that gets no answer within ACTION_TIMEOUT_MS is written off as failed.
+  void start_bulk(std::shared_ptr<BulkJob> job) {
+    std::lock_guard<std::mutex> lk(bulk_mu_);
+    // Reap workers whose job has finished; done is their last store, so the join is immediate
+    for (auto it = bulk_threads_.begin(); it != bulk_threads_.end();) {
+      if (!it->second->done.load()) {
+        ++it;
+        continue;
+      }
+      if (it->first.joinable()) it->first.join();
+      it = bulk_threads_.erase(it);
+    }
+    bulk_threads_.emplace_back(std::thread([this, job]() { run_bulk(job); }), job);
+  }
+
+  // Write an action with a fresh ActionID; on_response runs on a reader thread when the matching
+  // Response arrives. Returns the ActionID. An identical action already in flight is not sent
+  // again: on_response joins it and the existing ActionID is returned. The rate limiter may delay
+  // the write; if the wait would exceed ACTION_TIMEOUT_MS the action is rejected (throws).
+  // urgent actions skip the wait but still consume tokens.
+  std::string send_action(const AmiAction& a, ResponseFn on_response = nullptr, bool urgent = false) {
+    return send_tracked(a, std::move(on_response), urgent).id;
+  }
+
+  // send_action for callers that may cancel(): the ticket names their own callback. event_lane
+  // writes on the event connection even when actions have their own.
+  ActionTicket send_tracked(const AmiAction& a, ResponseFn on_response = nullptr, bool urgent = false,
+                            bool event_lane = false) {
+    ActionTicket t;
+    if (!track(a, std::move(on_response), t, event_lane)) return t;
+    auto cfg = conf_.get();
+    bool waited = false;
+    if (!limiter_.acquire(cfg->action_rate, cfg->action_burst, 1,
+                          std::chrono::milliseconds(cfg->action_timeout_ms), urgent, waited)) {
+      forget(t, true);
+      actions_rejected_.fetch_add(1);
+      throw std::runtime_error("action rate limit exceeded");
+    }
+    if (waited) actions_limited_.fetch_add(1);
+    try {
+      write_raw(event_lane ? ev_ : action_conn(), serialize(a, t.id));
+      mark_written(a, t.id, std::chrono::steady_clock::now());
+      actions_sent_.fetch_add(1);
+    } catch (...) {
+      forget(t);
+      throw;
+    }
+    return t;
+  }
+
+  // Action path counters for the stats view
+  uint64_t actions_sent() const { return actions_sent_.load(); }
+  uint64_t actions_limited() const { return actions_limited_.load(); }
+  uint64_t actions_rejected() const { return actions_rejected_.load(); }
+  uint64_t actions_coalesced() const { return actions_coalesced_.load(); }
+  std::map<std::string, ActionLatency> action_latency() {
+    std::lock_guard<std::mutex> lk(latency_mu_);
+    return latency_;
+  }
+  size_t actions_in_flight() {
+    std::lock_guard<std::mutex> lk(pending_mu_);
+    return pending_.size();
+  }
+
+  // Send and wait for the Response, up to ACTION_TIMEOUT_MS
+  std::optional<AmiMessage> request(const AmiAction& a) {
+    auto prom = std::make_shared<std::promise<AmiMessage>>();
+    auto fut = prom->get_future();
+    ActionTicket t;
+    try {
+      t = send_tracked(a, [prom](const AmiMessage& m) { prom->set_value(m); });
+    } catch (...) {
+      return std::nullopt;
+    }
+    if (fut.wait_for(std::chrono::milliseconds(conf_.get()->action_timeout_ms)) != std::future_status::ready) {
+      forget(t);
+      return std::nullopt;
+    }
+    return fut.get();
+  }
+
+  // Non-blocking request for periodic samplers: poll the future from the UI loop, and cancel(id)
+  // if the reply is given up on. Throws like send_action.
+  std::future<AmiMessage> request_async(const AmiAction& a, ActionTicket& t, bool urgent = false,
+                                        bool event_lane = false) {
+    auto prom = std::make_shared<std::promise<AmiMessage>>();
+    auto fut = prom->get_future();
+    t = send_tracked(a, [prom](const AmiMessage& m) { prom->set_value(m); }, urgent, event_lane);
+    return fut;
+  }
+
+  // Drop this caller's callback; coalesced callers on the same ActionID keep waiting
+  void cancel(const ActionTicket& t) { forget(t); }
+
+  // Actions
+  bool hangup_channel(const std::string& channel) {
+    return request_ok({"Hangup", {{"Channel", channel}}});
+  }
+
+  bool bridge_kick(const std::string& bridge_id, const std::string& channel) {
+    // Asterisk 20 supports BridgeKick
+    return request_ok({"BridgeKick", {{"BridgeUniqueid", bridge_id}, {"Channel", channel}}});
+  }
+
+  bool bridge_destroy(const std::string& bridge_id) {
+    // More deterministic than hanging up one channel when you want the entire bridge ended
+    return request_ok({"BridgeDestroy", {{"BridgeUniqueid", bridge_id}}});
+  }
+
+  bool start_recording(const std::string& channel, const std::string& uniqueid) {
+    return request_ok(mixmonitor_action(*conf_.get(), channel, uniqueid));
+  }
+
+  bool stop_recording(const std::string& channel) {
+    return request_ok(stop_mixmonitor_action(channel));
+  }
+
+  bool pause_recording(const std::string& channel, bool pause) {
+    return request_ok(pause_mixmonitor_action(channel, pause));
+  }
+
+  // Async Originate of supervisor into the ChanSpy context. The supervisor leg is created with
+  // spy_uniqueid as its Uniqueid, so its Newchannel/Hangup can be tied to the session before the
+  // OriginateResponse event arrives. Does not wait: the Response is polled from the returned
+  // future, t.id is the ActionID. Throws like send_action.
+  std::future<AmiMessage> originate_supervisor_chanspy(const std::string& supervisor, const std::string& target_channel,
+                                                       const std::string& mode, const std::string& spy_uniqueid,
+                                                       ActionTicket& t) {
+    auto cfg = conf_.get();
+
+    // Dialplan expects extension like *55<mode><target>, in supervisor-monitor context.
+    // Example: exten "*551PJSIP/1001-0000002a"
+    std::string exten = spy_exten(*cfg, mode, target_channel);
+
+    return request_async({"Originate", {
+        {"Channel", supervisor},
+        {"Context", cfg->supervisor_context},
+        {"Exten", exten},
+        {"Priority", "1"},
+        {"Timeout", std::to_string(cfg->originate_timeout_ms)},
+        {"ChannelId", spy_uniqueid},
+        {"Async", "true"}}}, t);
+  }
+
+  // Move an answered supervisor leg to another ChanSpy variant without re-ringing the phone.
+  // Non-blocking like originate_supervisor_chanspy.
+  std::future<AmiMessage> redirect_supervisor_chanspy(const std::string& spy_channel, const std::string& target_channel,
+                                                      const std::string& mode, ActionTicket& t) {
+    auto cfg = conf_.get();
+    return request_async({"Redirect", {
+        {"Channel", spy_channel},
+        {"Context", cfg->supervisor_context},
+        {"Exten", spy_exten(*cfg, mode, target_channel)},
+        {"Priority", "1"}}}, t);
+  }
+
+  // Fire-and-forget Hangup for the UI thread; a failure goes to the audit log unless quiet.
+  // channel may also be a Uniqueid (ChannelId), which Asterisk resolves like a name.
+  void hangup_async(const std::string& channel, bool quiet = false) {
+    try {
+      send_action({"Hangup", {{"Channel", channel}}}, [this, channel, quiet](const AmiMessage& r) {
+        auto it = r.kv.find("Response");
+        if (!quiet && (it == r.kv.end() || lower(it->second) != "success")) note("Hangup FAILED: " + channel);
+      });
+    } catch (const std::exception& ex) {
+      note("Hangup not sent for " + channel + ": " + ex.what());
+    }
+  }
+
+private:
+  void connect_conn(AmiConn& c) {
+    tcp::resolver resolver(io_);
+    auto endpoints = resolver.resolve(node_.host, std::to_string(node_.port));
+    boost::asio::connect(c.socket, endpoints);
+
+    // Drain banner (non-blocking small read)
+    boost::system::error_code ec;
+    c.socket.non_blocking(true, ec);
+    if (!ec) {
+      for (int i = 0; i < 5; i++) {
+        char buf[1024];
+        c.socket.read_some(boost::asio::buffer(buf), ec);
+        if (ec) break;
+      }
+    }
+    c.socket.non_blocking(false, ec);
+  }
+
+  bool login_conn(AmiConn& c, bool events) {
+    auto cfg = conf_.get();
+    std::ostringstream oss;
+    oss << "Action: Login\r\n"
+        << "Username: " << cfg->ami_user << "\r\n"
+        << "Secret: " << cfg->ami_secret << "\r\n"
+        << "Events: " << (events ? "on" : "off") << "\r\n"
+        << "\r\n";
+    write_raw(c, oss.str());
+
+    AmiMessage msg;
+    read_message(c, msg);
+    auto it = msg.kv.find("Response");
+    if (it == msg.kv.end()) return false;
+    return lower(it->second) == "success";
+  }
+
+  void read_loop(AmiConn& c, EventBatch* batch, std::mutex* batch_mu, bool event_lane) {
+    // Each message is parsed into this scratch arena, rewound per message; the queued copy goes to
+    // the batch arena and response callbacks copy out what they keep
+    alignas(std::max_align_t) std::byte scratch_buf[16 * 1024];
+    std::pmr::monotonic_buffer_resource scratch(scratch_buf, sizeof(scratch_buf));
+    while (g_running.load()) {
+      scratch.release();
+      try {
+        uint64_t allocs = t_heap_allocs;
+        AmiMessage msg(&scratch);
+        read_message(c, msg);
+        messages_read_.fetch_add(1);
+        last_rx_ms_.store(std::chrono::duration_cast<std::chrono::milliseconds>(
+            msg.received.time_since_epoch()).count());
+        if (dispatch_response(msg)) continue;
+        if (event_lane) {
+          check_sequence(msg);
+          match_effect(msg);
+          enforce_quarantine(msg);
+        }
+        {
+          std::lock_guard<std::mutex> lk(*batch_mu);
+          batch->push(msg);
+          if (size_t dropped = batch->trim(20000)) {
+            queue_dropped_.fetch_add(dropped);
+            resync_wanted_.store(true);
+          }
+          batch->note_parsed(t_heap_allocs - allocs, msg.received);
+        }
+      } catch (const std::exception& ex) {
+        // The event reader owns reconnecting both connections. A failed action connection closes
+        // the event connection too, so the node goes down and both are rebuilt together.
+        if (!event_lane) {
+          std::lock_guard<std::mutex> lk(ev_.write_mu);
+          if (reconnecting_.load() || !g_running.load()) break;
+          note(std::string("AMI action connection lost: ") + ex.what());
+          boost::system::error_code ec;
+          ev_.socket.shutdown(tcp::socket::shutdown_both, ec);
+          break;
+        }
+        connected_.store(false);
+        if (!g_running.load()) break;
+        note(std::string("AMI connection lost: ") + ex.what());
+        if (!reconnect(batch, batch_mu)) break;
+      }
+    }
+  }
+
+  // Fail every outstanding action, so nobody waits out ACTION_TIMEOUT_MS for a dead socket
+  void fail_pending(const std::string& why) {
+    std::vector<ResponseFn> fns;
+    {
+      std::lock_guard<std::mutex> lk(pending_mu_);
+      for (auto& [id, p] : pending_) {
+        for (auto& w : p.fns) fns.push_back(std::move(w.fn));
+      }
+      pending_.clear();
+      inflight_by_key_.clear();
+    }
+    AmiMessage err;
+    err.kv["Response"] = "Error";
+    err.kv["Message"] = why;
+    err.received = err.at = std::chrono::steady_clock::now();
+    for (auto& fn : fns) {
+      if (fn) fn(err);
+    }
+  }
+
+  // Fresh socket on the same AmiConn. Writers hold write_mu, so they see either the old socket
+  // (and fail) or the connected new one.
+  void reopen(AmiConn& c) {
+    std::lock_guard<std::mutex> lk(c.write_mu);
+    boost::system::error_code ec;
+    c.socket.close(ec);
+    c.socket = tcp::socket(io_);
+    c.rbuf.consume(c.rbuf.size());
+    connect_conn(c);
+  }
+
+  // Runs on the event reader thread. Retries with backoff (1s doubling to 30s) until both
+  // connections are logged in again or the program stops.
+  bool reconnect(EventBatch* batch, std::mutex* batch_mu) {
+    // Set before either socket is touched: the action reader checks it under ev_.write_mu, which
+    // reopen() also takes, so it never shuts down a socket this reconnect already replaced
+    reconnecting_.store(true);
+    fail_pending("AMI connection lost");
+    if (act_) {
+      {
+        std::lock_guard<std::mutex> lk(act_->write_mu);
+        boost::system::error_code ec;
+        act_->socket.shutdown(tcp::socket::shutdown_both, ec);
+      }
+      if (action_reader_thread_.joinable()) action_reader_thread_.join();
+    }
+    int delay_s = 1;
+    while (g_running.load()) {
+      try {
+        reopen(ev_);
+        if (act_) reopen(*act_);
+        if (login_conn(ev_, true) && (!act_ || login_conn(*act_, false))) break;
+        note("AMI re-login rejected");
+      } catch (const std::exception& ex) {
+        note(std::string("AMI reconnect failed: ") + ex.what());
+      }
+      for (int i = 0; i < delay_s * 10 && g_running.load(); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      delay_s = std::min(delay_s * 2, 30);
+    }
+    reconnecting_.store(false);
+    if (!g_running.load()) return false;
+
+    last_seq_ = -1;
+    connected_.store(true);
+    reconnects_.fetch_add(1);
+    if (act_) {
+      action_reader_thread_ = std::thread([this, batch, batch_mu]() { read_loop(*act_, batch, batch_mu, false); });
+    }
+    note("AMI reconnected");
+    // Events were missed while down: rebuild channels, and re-read contact states
+    resync_wanted_.store(true);
+    try {
+      send_action({"PJSIPShowContacts", {}});
+    } catch (const std::exception&) {
+    }
+    return true;
+  }
+
+  // SequenceNumber (manager.conf debug=on) counts every event Asterisk raises, so a jump means
+  // events this connection never saw. Events outside the user's read classes or dropped by an
+  // eventfilter also leave gaps, so they only trigger a resync with SEQ_GAP_RESYNC=yes.
+  void check_sequence(const AmiMessage& m) {
+    auto it = m.kv.find("SequenceNumber");
+    if (it == m.kv.end()) return;
+    int64_t seq = to_int_safe(it->second);
+    int64_t last = last_seq_;
+    last_seq_ = seq;
+    if (last < 0 || seq == last + 1) return;
+    seq_gaps_.fetch_add(1);
+    // A lower number means Asterisk restarted: everything since is unknown
+    if (seq > last) seq_missing_.fetch_add(seq - last - 1);
+    if (conf_.get()->seq_gap_resync || seq <= last) resync_wanted_.store(true);
+  }
+
+  void enforce_quarantine(const AmiMessage& m) {
+    auto peers = std::atomic_load(&quarantine_);
+    if (!peers || peers->empty()) return;
+    auto ev = m.kv.find("Event");
+    if (ev == m.kv.end() || ev->second != "Newchannel") return;
+    auto chit = m.kv.find("Channel");
+    if (chit == m.kv.end()) return;
+    std::string channel(chit->second);
+    std::string tech, peer;
+    parse_tech_peer(channel, tech, peer);
+    if (!peers->count(peer)) return;
+
+    auto t0 = std::chrono::steady_clock::now();
+    try {
+      send_action({"Hangup", {{"Channel", channel}}}, [this, channel, peer, t0](const AmiMessage& r) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+        auto it = r.kv.find("Response");
+        bool ok = it != r.kv.end() && lower(it->second) == "success";
+        note("Quarantine " + peer + ": Hangup " + (ok ? "OK" : "FAILED") + " for new channel " + channel +
+             " (" + std::to_string(us) + "us from ingest to response)");
+      }, true);
+    } catch (...) {
+      note("Quarantine " + peer + ": could not send Hangup for " + channel);
+    }
+  }
+
+  void note(const std::string& s) {
+    std::lock_guard<std::mutex> lk(notes_mu_);
+    notes_.push_back(s);
+    while (notes_.size() > 1000) notes_.pop_front();
+  }
+
+  // Hand a Response to whoever is waiting on its ActionID. Events carrying an ActionID
+  // (OriginateResponse, EventList entries) are not consumed here.
+  bool dispatch_response(const AmiMessage& m) {
+    if (m.kv.count("Event")) return false;
+    auto it = m.kv.find("ActionID");
+    if (it == m.kv.end()) return false;
+    std::vector<Waiter> fns;
+    std::string action;
+    std::chrono::steady_clock::time_point written;
+    {
+      std::lock_guard<std::mutex> lk(pending_mu_);
+      auto pit = pending_.find(std::string(it->second));
+      if (pit == pending_.end()) return false;
+      fns = std::move(pit->second.fns);
+      action = std::move(pit->second.action);
+      written = pit->second.written;
+      inflight_by_key_.erase(pit->second.key);
+      pending_.erase(pit);
+    }
+    if (written != std::chrono::steady_clock::time_point{}) {
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(m.received - written).count();
+      std::lock_guard<std::mutex> lk(latency_mu_);
+      latency_[action].response.add(us > 0 ? us : 0);
+    }
+    for (auto& w : fns) {
+      if (w.fn) w.fn(m);
+    }
+    return true;
+  }
+
+  // Identical actions (same name and headers) share one in-flight ActionID
+  static std::string dedupe_key(const AmiAction& a) {
+    std::string k = a.name;
+    for (const auto& [hk, hv] : a.headers) k += "\n" + hk + ":" + hv;
+    return k;
+  }
+
+  // Register on_response for a. Returns true with a fresh id if the action must be written, or
+  // false with the id of an identical in-flight action that on_response now also waits on.
+  // Actions pinned to the event connection only coalesce with each other.
+  bool track(const AmiAction& a, ResponseFn on_response, ActionTicket& t, bool event_lane = false) {
+    std::string key = dedupe_key(a);
+    if (event_lane) key += "\n@event";
+    t.waiter = next_waiter_.fetch_add(1);
+    std::lock_guard<std::mutex> lk(pending_mu_);
+    auto kit = inflight_by_key_.find(key);
+    if (kit != inflight_by_key_.end()) {
+      t.id = kit->second;
+      pending_[t.id].fns.push_back({t.waiter, std::move(on_response)});
+      actions_coalesced_.fetch_add(1);
+      return false;
+    }
+    t.id = "cm-" + std::to_string(next_action_id_.fetch_add(1));
+    inflight_by_key_[key] = t.id;
+    pending_[t.id] = Pending{key, {{t.waiter, std::move(on_response)}}, a.name, {}};
+    return true;
+  }
+
+  // Called right after an action went out: starts its Response clock and, for actions with an
+  // observable effect, waits for the matching event (see match_effect)
+  void mark_written(const AmiAction& a, const std::string& id, std::chrono::steady_clock::time_point now) {
+    {
+      std::lock_guard<std::mutex> lk(pending_mu_);
+      auto pit = pending_.find(id);
+      if (pit != pending_.end()) pit->second.written = now;
+    }
+    std::string key = effect_key(a);
+    if (key.empty()) return;
+    std::lock_guard<std::mutex> lk(latency_mu_);
+    effects_.emplace(std::move(key), Expected{a.name, now});
+    // Effects not seen within a minute are written off (failed action, channel already gone)
+    if (now - effects_pruned_ > std::chrono::seconds(5)) {
+      effects_pruned_ = now;
+      for (auto it = effects_.begin(); it != effects_.end();) {
+        if (now - it->second.written < std::chrono::minutes(1)) {
+          ++it;
+          continue;
+        }
+        latency_[it->second.action].no_effect++;
+        it = effects_.erase(it);
+      }
+    }
+    effects_waiting_.store(effects_.size());
+  }
+
+  // Reader thread: an event that completes an expected effect records its latency
+  void match_effect(const AmiMessage& m) {
+    if (effects_waiting_.load() == 0) return;
+    std::string key = effect_event_key(m);
+    if (key.empty()) return;
+    std::lock_guard<std::mutex> lk(latency_mu_);
+    auto it = effects_.find(key);
+    if (it == effects_.end()) return;
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(m.received - it->second.written).count();
+    latency_[it->second.action].effect.add(us > 0 ? us : 0);
+    effects_.erase(it);
+    effects_waiting_.store(effects_.size());
+  }
+
+  // Remove one caller's callback. The entry stays while coalesced callers still wait on it, unless
+  // the action was never written (unsent): then they get an Error response now.
+  void forget(const ActionTicket& t, bool unsent = false) {
+    std::vector<Waiter> rest;
+    {
+      std::lock_guard<std::mutex> lk(pending_mu_);
+      auto pit = pending_.find(t.id);
+      if (pit == pending_.end()) return;
+      auto& fns = pit->second.fns;
+      fns.erase(std::remove_if(fns.begin(), fns.end(), [&](const Waiter& w) { return w.id == t.waiter; }),
+                fns.end());
+      if (!fns.empty() && !unsent) return;
+      rest = std::move(fns);
+      inflight_by_key_.erase(pit->second.key);
+      pending_.erase(pit);
+    }
+    if (rest.empty()) return;
+    AmiMessage err;
+    err.kv["Response"] = "Error";
+    err.kv["Message"] = "action not sent";
+    err.received = err.at = std::chrono::steady_clock::now();
+    for (auto& w : rest) {
+      if (w.fn) w.fn(err);
+    }
+  }
+
+  void run_bulk(const std::shared_ptr<BulkJob>& keep) {
+    BulkJob& job = *keep;
+    auto cfg = conf_.get();
+    const size_t window = (size_t)std::max(1, cfg->bulk_window);
+    const size_t refill_at = window / 2;
+    // With rate limiting on, a batch never exceeds the bucket depth so the limiter can pace it
+    const size_t batch_cap = cfg->action_rate > 0 ? (size_t)std::max(1.0, cfg->action_burst) : window;
+    const auto timeout = std::chrono::milliseconds(cfg->action_timeout_ms);
+
+    size_t next = 0;
+    while (g_running.load()) {
+      std::string batch;
+      std::vector<std::pair<size_t, std::string>> batch_ids;
+      int count = 0;
+      {
+        std::unique_lock<std::mutex> lk(job.mu);
+        auto last_progress = std::chrono::steady_clock::now();
+        size_t seen = job.inflight.size();
+        // Wait for the window to drain to the refill mark (or fully, once everything is sent)
+        while (g_running.load() && !job.inflight.empty() &&
+               (next == job.actions.size() || job.inflight.size() > refill_at)) {
+          job.cv.wait_for(lk, std::chrono::milliseconds(100));
+          if (job.inflight.size() != seen) {
+            seen = job.inflight.size();
+            last_progress = std::chrono::steady_clock::now();
+          } else if (std::chrono::steady_clock::now() - last_progress > timeout) {
+            abandon_inflight(job);
+            break;
+          }
+        }
+        if (next == job.actions.size() && job.inflight.empty()) break;
+
+        while (next < job.actions.size() && job.inflight.size() < window && (size_t)count < batch_cap) {
+          size_t idx = next++;
+          ActionTicket t;
+          bool fresh = track(job.actions[idx], [keep, idx](const AmiMessage& m) {
+            auto it = m.kv.find("Response");
+            bool ok = it != m.kv.end() && lower(it->second) == "success";
+            std::lock_guard<std::mutex> jlk(keep->mu);
+            if (!keep->inflight.erase(idx)) return;
+            (ok ? keep->ok : keep->failed).fetch_add(1);
+            keep->cv.notify_all();
+          }, t);
+          job.inflight[idx] = t;
+          if (!fresh) continue; // rides on an identical action already in flight
+          batch += serialize(job.actions[idx], t.id);
+          batch_ids.emplace_back(idx, t.id);
+          count++;
+        }
+      }
+      if (batch.empty()) continue;
+
+      // Pace the batch through the limiter; bulk jobs wait as long as it takes
+      bool waited = false;
+      limiter_.acquire(cfg->action_rate, cfg->action_burst, count, std::chrono::milliseconds(-1), false, waited);
+      if (waited) actions_limited_.fetch_add(count);
+
+      try {
+        write_raw(action_conn(), batch);
+        auto now = std::chrono::steady_clock::now();
+        for (const auto& [idx, id] : batch_ids) mark_written(job.actions[idx], id, now);
+        job.sent.fetch_add(count);
+        actions_sent_.fetch_add(count);
+      } catch (...) {
+        std::lock_guard<std::mutex> lk(job.mu);
+        abandon_inflight(job);
+        job.failed.fetch_add((int)(job.actions.size() - next));
+        next = job.actions.size();
+      }
+    }
+
+    job.elapsed_ms.store(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - job.started).count());
+    job.done.store(true);
+  }
+
+  // Caller holds job.mu. Drop pending handlers for unanswered actions and count them as failed.
+  void abandon_inflight(BulkJob& job) {
+    for (const auto& [idx, t] : job.inflight) forget(t);
+    job.failed.fetch_add((int)job.inflight.size());
+    job.inflight.clear();
+  }
+
+  bool request_ok(const AmiAction& a) {
+    auto msg = request(a);
+    if (!msg) return false;
+    auto it = msg->kv.find("Response");
+    return it != msg->kv.end() && lower(it->second) == "success";
+  }
+
+  static std::string serialize(const AmiAction& a, const std::string& id) {
+    std::string out;
+    out.reserve(64 + a.headers.size() * 32);
+    out += "Action: " + a.name + "\r\n";
+    out += "ActionID: " + id + "\r\n";
+    for (const auto& [k, v] : a.headers) out += k + ": " + v + "\r\n";
+    out += "\r\n";
+    return out;
+  }
+
+  AmiConn& action_conn() { return act_ ? *act_ : ev_; }
+
+  void write_raw(AmiConn& c, const std::string& s) {
+    std::lock_guard<std::mutex> lk(c.write_mu);
+    boost::asio::write(c.socket, boost::asio::buffer(s));
+  }
+
+  // Read the next message into msg; header strings and map nodes come from msg's own resource
+  void read_message(AmiConn& c, AmiMessage& msg) {
+    std::pmr::memory_resource* mr = msg.kv.get_allocator().resource();
+    while (true) {
+      std::string_view line = read_line_crlf(c);
+      if (line.empty()) {
+        if (msg.kv.empty()) continue;
+        msg.received = std::chrono::steady_clock::now();
+        msg.at = msg.received;
+        auto ts = msg.kv.find("Timestamp");
+        if (ts != msg.kv.end()) {
+          double pbx = std::strtod(ts->second.c_str(), nullptr);
+          if (pbx > 0) {
+            std::chrono::duration<double> wall = std::chrono::system_clock::now().time_since_epoch();
+            auto age = std::chrono::duration<double>(wall.count() - pbx);
+            msg.at = msg.received - std::chrono::duration_cast<std::chrono::steady_clock::duration>(age);
+            msg.stamped = true;
+          }
+        }
+        return;
+      }
+      auto pos = line.find(':');
+      if (pos == std::string_view::npos) continue;
+      std::string_view k = trim_view(line.substr(0, pos));
+      std::string_view v = trim_view(line.substr(pos + 1));
+      std::pmr::string& out = msg.kv[std::pmr::string(k, mr)];
+      if (k == "Output" || k == "ChanVariable" || k == "DestChanVariable") {
+        // Command responses repeat Output: once per line of CLI output, channel events repeat
+        // ChanVariable: NAME=value once per manager.conf channelvars entry
+        if (!out.empty()) out += '\n';
+        out += v;
+        continue;
+      }
+      out.assign(v.data(), v.size());
+    }
+  }
+
+  // The line stays valid until the next read on c
+  std::string_view read_line_crlf(AmiConn& c) {
+    boost::asio::read_until(c.socket, c.rbuf, "\r\n");
+    std::istream is(&c.rbuf);
+    std::getline(is, c.line);
+    if (!c.line.empty() && c.line.back() == '\r') c.line.pop_back();
+    return c.line;
+  }
+
+  boost::asio::io_context& io_;
+  AmiConn ev_;                   // Events: on, also carries actions when there is no action lane
+  std::unique_ptr<AmiConn> act_; // Events: off, optional
+  const ConfigStore& conf_;
+  AmiNodeConfig node_;
+  std::thread reader_thread_;
+  std::thread action_reader_thread_;
+  std::atomic_bool connected_{false};
+  std::atomic_bool act_fallback_{false};
+  std::atomic<uint64_t> messages_read_{0};
+  std::atomic<int64_t> last_rx_ms_{0};
+  int64_t last_seq_ = -1; // event lane reader only
+  std::atomic<uint64_t> seq_gaps_{0};
+  std::atomic<uint64_t> seq_missing_{0};
+  std::atomic<uint64_t> queue_dropped_{0};
+  std::atomic_bool resync_wanted_{false};
+  std::atomic<uint64_t> reconnects_{0};
+  std::atomic_bool reconnecting_{false}; // event reader is rebuilding the connections
+  std::atomic<uint64_t> next_action_id_{1};
+  std::atomic<uint64_t> next_waiter_{1};
+
+  struct Waiter {
+    uint64_t id;
+    ResponseFn fn;
+  };
+  struct Pending {
+    std::string key;         // dedupe key of the action on the wire
+    std::vector<Waiter> fns; // the sender plus any coalesced duplicates
+    std::string action;          // Action: name, for the latency histograms
+    std::chrono::steady_clock::time_point written{}; // epoch until the write went out
+  };
+  std::mutex pending_mu_;
+  std::unordered_map<std::string, Pending> pending_;             // ActionID -> waiters
+  std::unordered_map<std::string, std::string> inflight_by_key_; // dedupe key -> ActionID
+
+  TokenBucket limiter_;
+  std::atomic<uint64_t> actions_sent_{0};
+  std::atomic<uint64_t> actions_limited_{0};   // delayed by the rate limiter
+  std::atomic<uint64_t> actions_rejected_{0};  // limiter wait would exceed ACTION_TIMEOUT_MS
+  std::atomic<uint64_t> actions_coalesced_{0}; // identical to one in flight, not sent
+
+  // Per action name: write -> Response, and write -> the event showing the action took effect
+  struct Expected {
+    std::string action;
+    std::chrono::steady_clock::time_point written;
+  };
+  std::mutex latency_mu_;
+  std::map<std::string, ActionLatency> latency_;
+  std::unordered_map<std::string, Expected> effects_; // effect_key -> action waiting for it
+  std::atomic<size_t> effects_waiting_{0};
+  std::chrono::steady_clock::time_point effects_pruned_ = std::chrono::steady_clock::now();
+  std::mutex bulk_mu_;
+  std::vector<std::pair<std::thread, std::shared_ptr<BulkJob>>> bulk_threads_; // worker, its job
+  std::shared_ptr<const std::set<std::string>> quarantine_;
+  std::mutex notes_mu_;
+  std::deque<std::string> notes_;
+};
+
+// --- State Store ---
+// Shared by all nodes. Only touched from the UI thread, so no locking.
+struct AuditLog {
+  std::deque<std::string> lines; // last N actions/events of interest
+
+  void add(const std::string& s) {
+    lines.push_back(now_ts() + "  " + s);
+    while (lines.size() > 2000) lines.pop_front();
+  }
+};
+
+// Supervisor ChanSpy call, tracked from the Originate through the spy leg's Hangup
+struct SpySession {
+  std::string spy_uniqueid;   // assigned via Originate ChannelId
+  std::string action_id;      // matches the OriginateResponse event
+  std::string supervisor;     // endpoint dialed, e.g. PJSIP/9000
+  std::string spy_channel;    // supervisor leg, known once its Newchannel arrives
+  std::string target_channel; // channel being spied on
+  std::string mode = "listen"; // listen|whisper|barge
+  std::string state = "originating"; // originating|ringing|answered|spying
+  bool qa = false;                   // started by the QA sampler
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  // Outstanding Originate/Redirect Responses, polled by the UI loop (poll_spy_actions)
+  std::future<AmiMessage> originate_reply;
+  ActionTicket originate_ticket;
+  std::future<AmiMessage> redirect_reply;
+  ActionTicket redirect_ticket;
+  std::string redirect_mode;
+  std::chrono::steady_clock::time_point action_sent;
+};
+
+struct QaStratum {
+  uint64_t answered = 0;
+  uint64_t sampled = 0;
+  uint64_t skipped = 0; // sampled but no supervisor free or concurrency limit reached
+};
+
+struct QaPick {
+  std::string supervisor;
+  std::string target;
+};
+
+// One dialplan step (context,exten,priority) as timed by the profiler
+struct DialplanStep {
+  std::string context;
+  std::string exten;
+  std::string priority;
+  std::string app;
+  LatencyHistogram hist;
+};
+
+static constexpr size_t kMaxDialplanSteps = 4096; // per node; further steps are counted, not timed
+
+// Qualify health of one PJSIP endpoint, from ContactStatus events and the startup ContactList
+struct EndpointHealth {
+  std::map<std::string, std::string> contacts; // contact URI -> last ContactStatus
+  std::string status = "unknown";              // reachable|unreachable|unknown, over all contacts
+  uint64_t last_rtt_us = 0;
+  RollingHistogram rtt;
+  Ring<std::chrono::steady_clock::time_point, 64> flaps; // reachable <-> unreachable changes
+
+  int flaps_within(std::chrono::seconds window) const {
+    auto since = std::chrono::steady_clock::now() - window;
+    int n = 0;
+    for (size_t i = 0; i < flaps.size; i++) {
+      if (flaps.at(i) >= since) n++;
+    }
+    return n;
+  }
+};
+
+static constexpr std::chrono::seconds kRttSpan{300}; // RTT histograms cover the last 5-10 minutes
+
+enum class DevState : uint8_t { Unknown, Idle, InUse, Busy, Ringing, OnHold, Unavailable, Invalid, Count };
+
+static const char* dev_state_name(DevState s) {
+  static const char* const kNames[] = {"Unknown", "Idle", "InUse", "Busy", "Ringing", "OnHold", "Unavailable", "Invalid"};
+  return kNames[(int)s];
+}
+
+// DeviceStateChange "State:" values
+static DevState parse_device_state(const std::string& v) {
+  if (v == "NOT_INUSE") return DevState::Idle;
+  if (v == "INUSE") return DevState::InUse;
+  if (v == "BUSY") return DevState::Busy;
+  if (v == "RINGING" || v == "RINGINUSE") return DevState::Ringing;
+  if (v == "ONHOLD") return DevState::OnHold;
+  if (v == "UNAVAILABLE") return DevState::Unavailable;
+  if (v == "INVALID") return DevState::Invalid;
+  return DevState::Unknown;
+}
+
+// ExtensionStatus "Status:" bitmask (ast_extension_states)
+static DevState parse_extension_status(int v) {
+  if (v < 0) return DevState::Invalid;
+  if (v == 0) return DevState::Idle;
+  if (v & 4) return DevState::Unavailable;
+  if (v & 8) return DevState::Ringing;
+  if (v & 16) return DevState::OnHold;
+  if (v & 2) return DevState::Busy;
+  return DevState::InUse;
+}
+
+// Device and hint states for BLF. Each device name is interned to a dense id once; after that an
+// event is a hash lookup and an array store. Bursts for one device within a UI frame collapse
+// into a single update at commit().
+struct DeviceIndex {
+  struct Slot {
+    std::string exten;                 // hint extension, once an ExtensionStatus names it
+    DevState state = DevState::Unknown;   // as shown
+    DevState pending = DevState::Unknown; // latest from events, not yet committed
+    bool dirty = false;
+    uint32_t changes = 0;
+    std::chrono::steady_clock::time_point since = std::chrono::steady_clock::now();
+  };
+
+  std::unordered_map<std::string, uint32_t> ids;
+  std::vector<std::string> names; // id -> device
+  std::vector<Slot> slots;        // id -> state
+  std::vector<uint32_t> dirty;    // ids set since the last commit
+  std::array<int, (int)DevState::Count> totals{};
+  uint64_t events = 0;
+  uint64_t updates = 0;
+
+  uint32_t intern(const std::string& name) {
+    auto it = ids.find(name);
+    if (it != ids.end()) return it->second;
+    uint32_t id = (uint32_t)names.size();
+    ids.emplace(name, id);
+    names.push_back(name);
+    slots.emplace_back();
+    totals[(int)DevState::Unknown]++;
+    return id;
+  }
+
+  void set(uint32_t id, DevState s) {
+    events++;
+    Slot& sl = slots[id];
+    sl.pending = s;
+    if (!sl.dirty) {
+      sl.dirty = true;
+      dirty.push_back(id);
+    }
+  }
+
+  // Once per UI frame
+  void commit(std::chrono::steady_clock::time_point now) {
+    for (uint32_t id : dirty) {
+      Slot& sl = slots[id];
+      sl.dirty = false;
+      if (sl.pending == sl.state) continue;
+      totals[(int)sl.state]--;
+      totals[(int)sl.pending]++;
+      sl.state = sl.pending;
+      sl.since = now;
+      sl.changes++;
+      updates++;
+    }
+    dirty.clear();
+  }
+};
+
+// Sliding-window outcome counters for one queue
+struct QueueWindow {
+  explicit QueueWindow(size_t buckets, std::chrono::seconds width)
+      : answered(buckets, width), answered_in_sl(buckets, width), abandoned(buckets, width) {}
+  SlidingCounter answered;
+  SlidingCounter answered_in_sl;
+  SlidingCounter abandoned;
+};
+
+// Live app_queue statistics. Waiting callers are kept in join order with a hash from caller to
+// list position, so join, leave and longest wait are all O(1).
+struct QueueStats {
+  struct Waiting {
+    std::string caller;
+    std::chrono::steady_clock::time_point joined;
+  };
+  std::list<Waiting> waiting;
+  std::unordered_map<std::string, std::list<Waiting>::iterator> waiting_by_caller;
+  QueueWindow last5m{30, std::chrono::seconds(10)};
+  QueueWindow last1h{60, std::chrono::seconds(60)};
+  uint64_t agents_talking = 0;
+
+  void leave(const std::string& caller) {
+    auto it = waiting_by_caller.find(caller);
+    if (it == waiting_by_caller.end()) return;
+    waiting.erase(it->second);
+    waiting_by_caller.erase(it);
+  }
+};
+
+// Hangups with one Q.850 cause on one trunk and direction
+struct CauseCounter {
+  std::string text; // Cause-txt as last reported
+  SlidingCounter last1m{6, std::chrono::seconds(10)};
+  SlidingCounter last15m{15, std::chrono::seconds(60)};
+  SlidingCounter last1h{60, std::chrono::seconds(60)};
+  uint64_t total = 0;
+  std::chrono::steady_clock::time_point spike_at = std::chrono::steady_clock::time_point::min();
+};
+
+struct TrunkCauses {
+  std::string trunk;
+  std::string dir;
+  SlidingCounter calls15m{15, std::chrono::seconds(60)}; // every hangup, for the failure share
+  std::map<int, CauseCounter> causes;
+};
+
+// One outstanding Getvar for a channel's audio format
+struct FormatQuery {
+  std::string channel;
+  std::string var; // audionativeformat|audioreadformat|audiowriteformat
+  ActionTicket id;
+  std::future<AmiMessage> reply;
+  std::chrono::steady_clock::time_point sent;
+};
+
+static constexpr size_t kMaxFormatQueries = 96; // outstanding Getvar per node (32 channels)
+
+// Depth history of one Asterisk taskprocessor, one entry per sample
+struct TaskprocSeries {
+  Ring<uint32_t, 60> depth;  // "In Queue"
+  uint64_t processed = 0;    // cumulative "Processed" at the last sample
+  double rate = 0;           // tasks/s between the last two samples
+  uint32_t max_depth = 0;    // Asterisk's own high mark since start
+  uint32_t high_water = 0;
+  bool alert = false;
+  uint64_t seen = 0;         // sample number it last appeared in
+};
+
+// The heartbeat RTT histogram rotates every this many ping intervals (2-4 minutes at the default 5s)
+static constexpr int kPingRttIntervals = 24;
+
+// AMI Ping heartbeat on one node; only touched from the UI thread
+struct Heartbeat {
+  std::future<AmiMessage> reply;     // on the event connection
+  ActionTicket reply_id;
+  std::future<AmiMessage> act_reply; // on the action connection, when there is one
+  ActionTicket act_reply_id;
+  bool round_lost = false;           // a Ping of the current round went unanswered
+  std::chrono::steady_clock::time_point sent;
+  std::chrono::steady_clock::time_point last = std::chrono::steady_clock::time_point::min();
+  RollingHistogram rtt; // sent -> Response parsed by the reader
+  uint64_t last_rtt_us = 0;
+  int missed = 0; // in a row
+  uint64_t pings = 0, lost = 0, dead = 0;
+};
+
+// Channel resync after lost events: a CoreShowChannels listing reconciled against the store.
+// Only touched from the UI thread.
+struct ChannelResync {
+  bool pending = false; // wanted, waiting for the rate limit
+  bool running = false;
+  ActionTicket action;
+  std::chrono::steady_clock::time_point started;
+  std::chrono::steady_clock::time_point last = std::chrono::steady_clock::time_point::min();
+  std::unordered_set<std::string> seen; // channels listed by the running resync
+  uint64_t gaps_logged = 0;             // AmiClient::seq_gaps() already reported
+  uint64_t dropped_logged = 0;
+  uint64_t runs = 0, added = 0, removed = 0;
+};
+
+// Periodic "core show taskprocessors" on one node; only touched from the UI thread
+struct TaskprocSampler {
+  std::map<std::string, TaskprocSeries> series;
+  std::future<AmiMessage> reply;
+  ActionTicket reply_id;
+  std::chrono::steady_clock::time_point sent;
+  std::chrono::steady_clock::time_point last = std::chrono::steady_clock::time_point::min();
+  double interval_s = 0; // between the last two requests, for the processed rate
+  uint64_t samples = 0;
+  uint64_t failures = 0;
+  bool denied = false; // AMI user lacks the command class; logged once
+};
+
+static constexpr std::chrono::seconds kLagSpan{60}; // event lag histogram covers the last 1-2 minutes
+
+// Per-node shard of call state. Each node's events are applied only to its own store.
+struct StateStore {
+  std::string node;                                              // PBX node name
+  bool tag_log = false;                                          // prefix audit lines with [node]
+  AuditLog* audit = nullptr;
+  std::unordered_map<std::string, ChannelInfo> channels_by_name; // key=Channel
+  std::unordered_map<std::string, std::string> chan_by_uniqueid; // uniqueid -> Channel
+  std::unordered_map<std::string, BridgeInfo> bridges;           // bridge_id -> bridge info
+  std::unordered_map<std::string, std::set<std::string>> channels_by_peer; // peer -> Channels
+  std::unordered_map<std::string, std::set<std::string>> channels_by_queue; // queue -> caller Channels
+  std::unordered_map<std::string, SpySession> spy_sessions;     // spy uniqueid -> session
+  std::unordered_map<std::string, std::string> spy_by_target;   // target Channel -> spy uniqueid
+  std::unordered_map<std::string, std::string> spy_by_supervisor; // supervisor endpoint -> spy uniqueid
+  // Spy legs dropped while still originating: hung up by Uniqueid, and again if their Newchannel
+  // shows up later. Pruned after the originate timeout.
+  std::unordered_map<std::string, std::chrono::steady_clock::time_point> spy_cancelled;
+  std::vector<AmiAction> outbox; // actions decided while applying events, sent by the UI loop
+
+  // QA sampler. Decisions are made once per Linkedid; picks are originated by the UI loop.
+  std::unordered_set<std::string> qa_decided;          // Linkedids already considered; dropped with their call log
+  std::map<std::string, QaStratum> qa_strata;          // stratum -> counters
+  std::vector<QaPick> qa_picks;
+  std::set<std::string> qa_reserved;                   // pool supervisors picked, not yet originated
+  int qa_active = 0;                                   // live sessions with qa set
+  size_t qa_next = 0;                                  // round-robin position in the pool
+
+  std::unordered_map<std::string, DialplanStep> dialplan_steps; // "context,exten,priority" -> timings
+  uint64_t dialplan_steps_dropped = 0;                          // Newexten past kMaxDialplanSteps
+  std::string step_key;                                         // built per Newexten, reused
+
+  TaskprocSampler taskprocs;
+
+  std::deque<std::string> fmt_wanted;     // bridged channels whose formats are not fetched yet
+  std::unordered_map<std::string, EndpointHealth> endpoints; // PJSIP endpoint (= channel peer) -> health
+  DeviceIndex devices;
+  std::map<std::string, QueueStats> queues; // queue name -> live stats
+  std::map<std::string, TrunkCauses> hangup_causes; // "<trunk> <dir>" -> cause counters
+  ChannelResync resync;
+  Heartbeat heartbeat;
+  ChanHistoryPool history;
+  std::unordered_map<std::string, CallLog> calls;                // Linkedid -> timeline events
+  std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> calls_ended; // oldest first
+  std::chrono::steady_clock::time_point calls_swept; // last idle-call sweep
+
+  // How far behind the PBX events are applied, from their Timestamp header. Includes clock
+  // skew between the hosts; a PBX clock running ahead shows as negative last_lag_us.
+  RollingHistogram event_lag;
+  int64_t last_lag_us = 0;
+  uint64_t stamped_events = 0;
+
+  void note_event_lag(std::chrono::steady_clock::time_point at) {
+    auto now = std::chrono::steady_clock::now();
+    last_lag_us = std::chrono::duration_cast<std::chrono::microseconds>(now - at).count();
+    event_lag.add(last_lag_us > 0 ? (uint64_t)last_lag_us : 0, now, kLagSpan);
+    stamped_events++;
+  }
+  std::vector<FormatQuery> fmt_inflight;
+
+  void index_peer(const ChannelInfo& c) {
+    if (!c.peer.empty()) channels_by_peer[c.peer].insert(c.channel);
+  }
+  void unindex_peer(const ChannelInfo& c) {
+    auto it = channels_by_peer.find(c.peer);
+    if (it == channels_by_peer.end()) return;
+    it->second.erase(c.channel);
+    if (it->second.empty()) channels_by_peer.erase(it);
+  }
+  void unindex_queue(const ChannelInfo& c) {
+    auto it = channels_by_queue.find(c.queue);
+    if (it == channels_by_queue.end()) return;
+    it->second.erase(c.channel);
+    if (it->second.empty()) channels_by_queue.erase(it);
+  }
+
+  // Channel by a header value. unordered_map has no heterogeneous lookup in C++17, so the name is
+  // copied into a buffer that keeps its capacity rather than into a fresh string per event.
+  ChannelInfo* find_channel(std::string_view name) {
+    lookup_key_.assign(name.data(), name.size());
+    auto it = channels_by_name.find(lookup_key_);
+    return it == channels_by_name.end() ? nullptr : &it->second;
+  }
+
+  void log_line(const std::string& s) {
+    if (audit) audit->add(tag_log ? "[" + node + "] " + s : s);
+  }
+
+private:
+  std::string lookup_key_;
+};
+
+// One monitored PBX: its own AMI connection and reader thread, inbound queue and state shard.
+struct PbxNode {
+  PbxNode(boost::asio::io_context& io, const ConfigStore& conf, const AmiNodeConfig& nc)
+      : ami(io, conf, nc) {}
+
+  AmiClient ami;
+  EventBatch batch;
+  std::mutex q_mu;
+  StateStore st;
+};
+
+using NodeList = std::vector<std::unique_ptr<PbxNode>>;
+
+// Operator view state, independent of which node a call lives on.
+struct UiState {
+  std::string filter = "all";    // all|inbound|outbound|internal
+  std::string sort = "duration"; // duration|node|direction|parts
+  int selected_bridge_index = 0;
+  int selected_member_index = 0;
+  std::string view = "calls";    // calls|logs|stats|profile|taskprocs|endpoints|devices|causes|history|timeline
+  std::string endpoint_sort = "rtt"; // rtt|flaps|name
+  int history_node = 0;              // member whose events the history view shows
+  std::string history_channel;
+  std::string timeline_linkedid;     // call shown by the timeline view, on history_node
+  std::vector<std::shared_ptr<BulkJob>> bulk_jobs; // latest bulk operation, shown in the header
+  std::vector<std::shared_ptr<BulkJob>> bulk_older; // earlier operations not yet reported
+  std::set<std::string> quarantine_manual;          // trunks quarantined from the TUI
+  std::set<std::string> quarantine_active;          // manual + QUARANTINE_TRUNKS, as enforced
+};
+
+// Configured trunk prefix found in channel, or "" for extensions
+static std::string trunk_prefix_of(const std::string& channel, const AppConfig& cfg) {
+  std::string lch = lower(channel);
+  for (const auto& p : cfg.trunk_prefixes) {
+    if (lch.find(lower(p)) != std::string::npos) return p;
+  }
+  return "";
+}
+
+static bool matches_trunk_prefix(const std::string& channel, const AppConfig& cfg) {
+  return !trunk_prefix_of(channel, cfg).empty();
+}
+
+static std::string classify_dir_heuristic(const ChannelInfo& c) {
+  // If dialplan sets CALL_DIR, prefer it
+  if (!c.call_dir.empty()) return lower(c.call_dir);
+
+  // Heuristic:
+  // - Trunk-like channel names are inbound/outbound depending on context/exten and connected/caller
+  // - Internal if peer looks numeric extension and context suggests internal
+  // This is best-effort. For accuracy, set __CALL_DIR in dialplan at entry.
+
+  // Internal extension guess: peer is digits and not obviously trunk
+  bool peer_digits = !c.peer.empty() && std::all_of(c.peer.begin(), c.peer.end(), ::isdigit);
+
+  if (c.is_trunk) {
+    // If caller looks like PSTN and connected looks like extension, likely inbound
+    bool conn_is_ext = !c.connected_num.empty() && std::all_of(c.connected_num.begin(), c.connected_num.end(), ::isdigit) && c.connected_num.size() <= 6;
+    bool caller_is_ext = !c.caller_num.empty() && std::all_of(c.caller_num.begin(), c.caller_num.end(), ::isdigit) && c.caller_num.size() <= 6;
+    if (conn_is_ext && !caller_is_ext) return "inbound";
+    if (caller_is_ext && !conn_is_ext) return "outbound";
+    return "unknown";
+  }
+
+  if (peer_digits) return "internal";
+  return "unknown";
+}
+
+// Refresh the cached trunk flag and direction. Called whenever a field the heuristic reads changes.
+static void classify_channel(ChannelInfo& c, const AppConfig& cfg) {
+  c.is_trunk = matches_trunk_prefix(c.channel, cfg);
+  c.dir = classify_dir_heuristic(c);
+}
+
+static SpySession* find_spy_by_channel(StateStore& st, std::string_view spy_channel) {
+  for (auto& [uid, s] : st.spy_sessions) {
+    if (s.spy_channel == spy_channel) return &s;
+  }
+  return nullptr;
+}
+
+static void end_spy_session(StateStore& st, std::string spy_uid, const std::string& why) {
+  auto it = st.spy_sessions.find(spy_uid);
+  if (it == st.spy_sessions.end()) return;
+  const SpySession& s = it->second;
+  auto secs = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - s.started).count();
+  st.log_line("Monitor " + s.supervisor + " -> " + s.target_channel + " ended (" + why + ", " +
+              std::to_string(secs) + "s)");
+  auto tit = st.spy_by_target.find(s.target_channel);
+  if (tit != st.spy_by_target.end() && tit->second == spy_uid) st.spy_by_target.erase(tit);
+  auto sup = st.spy_by_supervisor.find(s.supervisor);
+  if (sup != st.spy_by_supervisor.end() && sup->second == spy_uid) st.spy_by_supervisor.erase(sup);
+  if (s.qa) st.qa_active--;
+  st.spy_sessions.erase(it);
+}
+
+static int secs_since(std::chrono::steady_clock::time_point t0) {
+  if (t0 == std::chrono::steady_clock::time_point::min()) return 0;
+  auto now = std::chrono::steady_clock::now();
+  return (int)std::chrono::duration_cast<std::chrono::seconds>(now - t0).count();
+}
+
+// --- QA sampling ---
+// FNV-1a rather than std::hash: stable across builds and restarts, so a Linkedid always gets
+// the same sampling decision.
+static uint64_t fnv1a(const std::string& s) {
+  uint64_t h = 1469598103934665603ULL;
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// Queue wins over trunk: a queued inbound call is judged by its queue
+static std::string qa_stratum(const StateStore& st, const AppConfig& cfg, const BridgeInfo& b) {
+  std::string trunk;
+  for (const auto& ch : b.channels) {
+    auto it = st.channels_by_name.find(ch);
+    if (it == st.channels_by_name.end()) continue;
+    if (!it->second.queue.empty()) return "queue:" + it->second.queue;
+    if (trunk.empty() && it->second.is_trunk) trunk = trunk_prefix_of(ch, cfg);
+  }
+  return trunk.empty() ? "internal" : trunk;
+}
+
+static double qa_percent(const AppConfig& cfg, const std::string& stratum) {
+  auto it = cfg.qa_strata_percent.find(stratum);
+  return it != cfg.qa_strata_percent.end() ? it->second : cfg.qa_sample_percent;
+}
+
+static bool qa_enabled(const AppConfig& cfg) {
+  if (cfg.qa_supervisors.empty() && cfg.supervisor_endpoint.empty()) return false;
+  if (cfg.qa_sample_percent > 0) return true;
+  for (const auto& [k, pct] : cfg.qa_strata_percent) {
+    if (pct > 0) return true;
+  }
+  return false;
+}
+
+// Called from BridgeEnter once the bridge has two parties. Looks only at this bridge's members
+// and the per-supervisor index; the pick is originated by the UI loop.
+static void qa_consider(StateStore& st, const AppConfig& cfg, const BridgeInfo& b, const ChannelInfo& entered) {
+  if (b.channels.size() < 2 || entered.linkedid.empty() || !qa_enabled(cfg)) return;
+  if (!st.qa_decided.insert(entered.linkedid).second) return;
+
+  std::string stratum = qa_stratum(st, cfg, b);
+  QaStratum& qs = st.qa_strata[stratum];
+  qs.answered++;
+  double pct = qa_percent(cfg, stratum);
+  if (fnv1a(entered.linkedid) % 10000 >= (uint64_t)(pct * 100)) return;
+  qs.sampled++;
+
+  // Spy on the extension side when there is one; ChanSpy hears both parties either way
+  std::string target = entered.channel;
+  for (const auto& ch : b.channels) {
+    auto it = st.channels_by_name.find(ch);
+    if (it != st.channels_by_name.end() && !it->second.is_trunk) {
+      target = ch;
+      break;
+    }
+  }
+  if (st.spy_by_target.count(target)) return; // an operator is already on it
+
+  std::vector<std::string> pool = cfg.qa_supervisors;
+  if (pool.empty()) pool.push_back(cfg.supervisor_endpoint);
+  int limit = cfg.qa_max_concurrent > 0 ? cfg.qa_max_concurrent : (int)pool.size();
+  std::string sup;
+  if (st.qa_active + (int)st.qa_picks.size() < limit) {
+    for (size_t i = 0; i < pool.size(); i++) {
+      const std::string& cand = pool[(st.qa_next + i) % pool.size()];
+      if (st.spy_by_supervisor.count(cand) || st.qa_reserved.count(cand)) continue;
+      sup = cand;
+      st.qa_next = (st.qa_next + i + 1) % pool.size();
+      break;
+    }
+  }
+  if (sup.empty()) {
+    qs.skipped++;
+    st.log_line("QA: sampled " + target + " (" + stratum + "), no supervisor free");
+    return;
+  }
+  st.qa_reserved.insert(sup);
+  st.qa_picks.push_back({sup, target});
+}
+
+// --- Dialplan profiler ---
+// A step lasts from its Newexten to the channel's next one. The step still running at Hangup is
+// not recorded: its end is unknown.
+static void close_dialplan_step(StateStore& st, ChannelInfo& c, std::chrono::steady_clock::time_point now) {
+  if (c.step.empty()) return;
+  auto it = st.dialplan_steps.find(c.step);
+  if (it != st.dialplan_steps.end()) {
+    it->second.hist.add((uint64_t)std::max<int64_t>(0,
+        std::chrono::duration_cast<std::chrono::microseconds>(now - c.step_at).count()));
+  }
+  c.step.clear();
+}
+
+static void profile_newexten(StateStore& st, ChannelInfo& c, const AmiMessage& m) {
+  auto get = [&](const char* k) -> std::string_view {
+    auto it = m.kv.find(k);
+    return it == m.kv.end() ? std::string_view() : std::string_view(it->second);
+  };
+  close_dialplan_step(st, c, m.at);
+
+  std::string_view exten = get("Extension");
+  if (exten.empty()) exten = get("Exten");
+  std::string& key = st.step_key;
+  key.assign(get("Context")).append(1, ',').append(exten).append(1, ',').append(get("Priority"));
+  if (!st.dialplan_steps.count(key)) {
+    if (st.dialplan_steps.size() >= kMaxDialplanSteps) {
+      st.dialplan_steps_dropped++;
+      return;
+    }
+    DialplanStep& d = st.dialplan_steps[key];
+    d.context = get("Context");
+    d.exten = exten;
+    d.priority = get("Priority");
+    d.app = get("Application");
+  }
+  c.step = key;
+  c.step_at = m.at;
+}
+
+// --- PJSIP endpoint health ---
+// ContactStatus (live) and ContactList (PJSIPShowContacts reply) both report one contact
+static void apply_contact_status(StateStore& st, const std::string& endpoint, const std::string& uri,
+                                 const std::string& status, const std::string& rtt_usec,
+                                 std::chrono::steady_clock::time_point now) {
+  if (endpoint.empty()) return;
+  EndpointHealth& e = st.endpoints[endpoint];
+  if (status == "Removed") e.contacts.erase(uri);
+  else e.contacts[uri] = status;
+
+  uint64_t rtt = (uint64_t)std::max(0, to_int_safe(rtt_usec));
+  if (rtt > 0) {
+    e.last_rtt_us = rtt;
+    e.rtt.add(rtt, now, kRttSpan);
+  }
+
+  std::string next = "unknown";
+  for (const auto& [u, cs] : e.contacts) {
+    if (cs == "Reachable") {
+      next = "reachable";
+      break;
+    }
+    if (cs == "Unreachable") next = "unreachable";
+  }
+  if (next == e.status) return;
+  if (e.status != "unknown" && next != "unknown") e.flaps.push(now);
+  if (e.status != "unknown" || next == "unreachable") st.log_line("Endpoint " + endpoint + " " + next);
+  e.status = next;
+}
+
+// --- Queue statistics ---
+// Callers are keyed by Uniqueid (Channel as fallback), which every app_queue event carries for the
+// caller; AgentConnect/AgentComplete describe the caller's channel too, the agent leg is DestChannel.
+static void apply_queue_event(StateStore& st, const AppConfig& cfg, std::string_view event, const AmiMessage& m) {
+  auto get = [&](const char* k) -> std::string {
+    auto it = m.kv.find(k);
+    return it == m.kv.end() ? std::string() : std::string(it->second);
+  };
+  std::string name = get("Queue");
+  if (name.empty()) return;
+  QueueStats& q = st.queues[name];
+  std::string caller = get("Uniqueid");
+  if (caller.empty()) caller = get("Channel");
+  auto now = m.at;
+
+  if (event == "QueueCallerJoin") {
+    q.leave(caller);
+    q.waiting.push_back({caller, now});
+    q.waiting_by_caller[caller] = std::prev(q.waiting.end());
+  } else if (event == "QueueCallerLeave") {
+    q.leave(caller);
+  } else if (event == "QueueCallerAbandon") {
+    q.leave(caller);
+    q.last5m.abandoned.add(now);
+    q.last1h.abandoned.add(now);
+  } else if (event == "AgentConnect") {
+    q.leave(caller);
+    bool in_sl = to_int_safe(get("HoldTime")) <= cfg.queue_sl_sec;
+    for (QueueWindow* w : {&q.last5m, &q.last1h}) {
+      w->answered.add(now);
+      if (in_sl) w->answered_in_sl.add(now);
+    }
+    q.agents_talking++;
+  } else if (event == "AgentComplete") {
+    if (q.agents_talking) q.agents_talking--;
+  }
+}
+
+// --- Hangup causes ---
+// Causes that point at the carrier or the network rather than the called party
+static bool is_failure_cause(int cause) {
+  switch (cause) {
+    case 3:   // no route to destination
+    case 21:  // call rejected
+    case 27:  // destination out of order
+    case 34:  // no circuit/channel available
+    case 38:  // network out of order
+    case 41:  // temporary failure
+    case 42:  // switching equipment congestion
+    case 44:  // requested channel not available
+    case 47:  // resource unavailable
+    case 102: // recovery on timer expiry
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool cause_spiking(CauseCounter& c, const AppConfig& cfg, std::chrono::steady_clock::time_point now) {
+  uint64_t m1 = c.last1m.sum(now);
+  uint64_t before = c.last15m.sum(now) - std::min(m1, c.last15m.sum(now));
+  return m1 >= (uint64_t)cfg.cause_spike_min && m1 * 14 > 3 * before;
+}
+
+// Only trunk legs are counted: extension hangups say nothing about a carrier
+static void count_hangup_cause(StateStore& st, const AppConfig& cfg, const ChannelInfo& c, const AmiMessage& m) {
+  if (!c.is_trunk) return;
+  auto cit = m.kv.find("Cause");
+  if (cit == m.kv.end() || cit->second.empty()) return;
+  int cause = to_int_safe(cit->second);
+  std::string trunk = trunk_prefix_of(c.channel, cfg);
+  TrunkCauses& tc = st.hangup_causes[trunk + " " + c.dir];
+  tc.trunk = trunk;
+  tc.dir = c.dir;
+  auto now = m.at;
+  tc.calls15m.add(now);
+  CauseCounter& cc = tc.causes[cause];
+  auto tit = m.kv.find("Cause-txt");
+  if (tit != m.kv.end()) cc.text = tit->second;
+  cc.last1m.add(now);
+  cc.last15m.add(now);
+  cc.last1h.add(now);
+  cc.total++;
+
+  if (!is_failure_cause(cause) || !cause_spiking(cc, cfg, now)) return;
+  // One log line per minute while the spike lasts
+  if (cc.spike_at == std::chrono::steady_clock::time_point::min() || now - cc.spike_at >= std::chrono::minutes(1)) {
+    st.log_line("Hangup cause spike: " + trunk + " " + c.dir + " cause " + std::to_string(cause) + " (" + cc.text +
+                ") x" + std::to_string(cc.last1m.sum(now)) + " in the last minute");
+    cc.spike_at = now;
+  }
+}
+
+// --- Channel variables ---
+// Value of NAME in newline-joined "NAME=value" ChanVariable lines, or nullptr
+static const char* find_chan_var(std::string_view vars, std::string_view name, size_t& len) {
+  size_t pos = 0;
+  while (pos < vars.size()) {
+    size_t end = vars.find('\n', pos);
+    if (end == std::string::npos) end = vars.size();
+    if (vars.compare(pos, name.size(), name) == 0 && pos + name.size() < end && vars[pos + name.size()] == '=') {
+      size_t v = pos + name.size() + 1;
+      len = end - v;
+      return vars.data() + v;
+    }
+    pos = end + 1;
+  }
+  return nullptr;
+}
+
+// Update a channel from the variables attached to an event. Returns true when the cached
+// classification has to be refreshed.
+static bool apply_chan_vars(ChannelInfo& c, std::string_view vars) {
+  size_t len = 0;
+  const char* v = find_chan_var(vars, "CALL_DIR", len);
+  if (!v) v = find_chan_var(vars, "__CALL_DIR", len);
+  if (!v || c.call_dir.compare(0, std::string::npos, v, len) == 0) return false;
+  c.call_dir.assign(v, len);
+  return true;
+}
+
+// Channel events carry the snapshot of their channel, and DestChannel's for two-party events.
+// With manager.conf channelvars=CALL_DIR this replaces the VarSet stream.
+static void apply_event_chan_vars(StateStore& st, const AppConfig& cfg, const AmiMessage& m) {
+  static const std::pair<const char*, const char*> kSides[] = {{"Channel", "ChanVariable"},
+                                                               {"DestChannel", "DestChanVariable"}};
+  for (const auto& [chan_key, vars_key] : kSides) {
+    auto vit = m.kv.find(vars_key);
+    if (vit == m.kv.end()) continue;
+    auto cit = m.kv.find(chan_key);
+    if (cit == m.kv.end()) continue;
+    ChannelInfo* c = st.find_channel(cit->second);
+    if (c && apply_chan_vars(*c, vit->second)) classify_channel(*c, cfg);
+  }
+}
+
+static void apply_resync_event(StateStore& st, const AppConfig& cfg, std::string_view event, const AmiMessage& m);
+
+// --- Channel history ---
+// The few fields that say what an event did to its channel
+static void history_detail(std::string_view event, const AmiMessage& m, char* out, size_t n) {
+  auto get = [&](const char* k) -> const char* {
+    auto it = m.kv.find(k);
+    return it == m.kv.end() ? "" : it->second.c_str();
+  };
+  out[0] = 0;
+  if (event == "Newchannel" || event == "Newstate") {
+    std::snprintf(out, n, "%s %s", get("ChannelStateDesc"), get("Exten"));
+  } else if (event == "BridgeEnter" || event == "BridgeLeave") {
+    std::snprintf(out, n, "%s", get("BridgeUniqueid"));
+  } else if (event == "Newexten") {
+    std::snprintf(out, n, "%s,%s,%s %s", get("Context"), get("Extension"), get("Priority"), get("Application"));
+  } else if (event == "DialBegin") {
+    std::snprintf(out, n, "-> %s", get("DestChannel"));
+  } else if (event == "DialEnd") {
+    std::snprintf(out, n, "%s %s", get("DestChannel"), get("DialStatus"));
+  } else if (event == "Hangup" || event == "HangupRequest" || event == "SoftHangupRequest") {
+    std::snprintf(out, n, "%s %s", get("Cause"), get("Cause-txt"));
+  } else if (event == "VarSet") {
+    std::snprintf(out, n, "%s=%s", get("Variable"), get("Value"));
+  } else if (event == "NewCallerid") {
+    std::snprintf(out, n, "%s %s", get("CallerIDNum"), get("CallerIDName"));
+  } else if (event == "NewConnectedLine") {
+    std::snprintf(out, n, "%s %s", get("ConnectedLineNum"), get("ConnectedLineName"));
+  } else if (event.rfind("QueueCaller", 0) == 0 || event.rfind("Agent", 0) == 0) {
+    std::snprintf(out, n, "%s", get("Queue"));
+  } else if (event == "DTMFEnd") {
+    std::snprintf(out, n, "%s %s", get("Digit"), get("Direction"));
+  } else if (event == "Hold") {
+    std::snprintf(out, n, "%s", get("MusicClass"));
+  } else if (event == "MixMonitorMute") {
+    std::snprintf(out, n, "%s %s", get("Direction"), get("State"));
+  } else if (event == "BlindTransfer") {
+    std::snprintf(out, n, "to %s@%s %s", get("Extension"), get("Context"), get("Result"));
+  } else if (event == "AttendedTransfer") {
+    std::snprintf(out, n, "%s %s %s", get("DestType"), get("SecondTransfererChannel"), get("Result"));
+  } else if (event == "ChanSpyStart") {
+    std::snprintf(out, n, "spied by %s", get("SpyerChannel"));
+  }
+}
+
+// --- Call timelines ---
+// Finished calls stay viewable for a while, within a fixed count
+static constexpr size_t kMaxEndedCalls = 1000;
+static constexpr std::chrono::minutes kEndedCallTtl{10};
+// Logs whose live count never reached zero (call already up before we connected, lost Newchannel)
+// are dropped once idle this long with none of their channels left in the store
+static constexpr std::chrono::minutes kIdleCallTtl{10};
+
+static bool timeline_event(std::string_view e) {
+  static const std::unordered_set<std::string_view> kEvents = {
+      "Newchannel", "Newstate", "BridgeEnter", "BridgeLeave", "DialBegin", "DialEnd", "Hold", "Unhold",
+      "BlindTransfer", "AttendedTransfer", "QueueCallerJoin", "QueueCallerLeave", "QueueCallerAbandon",
+      "AgentConnect", "Newexten", "MixMonitorStart", "MixMonitorStop", "ChanSpyStart", "Hangup"};
+  return kEvents.count(e) > 0;
+}
+
+static void record_timeline(StateStore& st, std::string_view event, const AmiMessage& m) {
+  if (!timeline_event(event)) return;
+  auto get = [&](const char* k) -> const std::pmr::string* {
+    auto it = m.kv.find(k);
+    return it == m.kv.end() ? nullptr : &it->second;
+  };
+  // Transfers name their channels by role
+  const std::pmr::string* ch = get("Channel");
+  const std::pmr::string* lid = get("Linkedid");
+  if (!ch) {
+    ch = get("TransfererChannel");
+    lid = get("TransfererLinkedid");
+  }
+  if (!ch) {
+    ch = get("OrigTransfererChannel");
+    lid = get("OrigTransfererLinkedid");
+  }
+  if (!ch) return;
+  std::string_view chan = *ch;
+  std::string linkedid;
+  if (lid) {
+    linkedid = *lid;
+  } else {
+    ChannelInfo* c = st.find_channel(chan);
+    if (!c) return;
+    linkedid = c->linkedid;
+  }
+  if (linkedid.empty()) return;
+
+  auto lit = st.calls.find(linkedid);
+  if (lit == st.calls.end()) {
+    // A Hangup alone does not start a timeline
+    if (event == "Hangup") return;
+    lit = st.calls.emplace(linkedid, CallLog{}).first;
+  }
+  CallLog& log = lit->second;
+  log.last_event = m.at;
+  auto cit = std::find(log.channels.begin(), log.channels.end(), chan);
+  if (cit == log.channels.end()) {
+    if (log.channels.size() >= 255) return;
+    log.channels.emplace_back(chan);
+    cit = log.channels.end() - 1;
+  }
+  if (event == "Newchannel") log.live++;
+  if (event == "Hangup" && log.live > 0 && --log.live == 0) {
+    log.ended = m.at;
+    st.calls_ended.emplace_back(m.at, linkedid);
+  }
+  if (log.entries.size() >= CallLog::kMaxEntries) {
+    log.dropped++;
+  } else {
+    CallLog::Entry e;
+    e.ev.at = m.at;
+    e.chan = (uint8_t)(cit - log.channels.begin());
+    std::snprintf(e.ev.type, sizeof(e.ev.type), "%.*s", (int)event.size(), event.data());
+    history_detail(event, m, e.ev.detail, sizeof(e.ev.detail));
+    log.entries.push_back(e);
+  }
+
+  // Expire finished calls; a call that came back to life (new channel) is not dropped
+  while (!st.calls_ended.empty() &&
+         (st.calls_ended.size() > kMaxEndedCalls || m.at - st.calls_ended.front().first > kEndedCallTtl)) {
+    auto it = st.calls.find(st.calls_ended.front().second);
+    if (it != st.calls.end() && it->second.live == 0) {
+      st.qa_decided.erase(it->first);
+      st.calls.erase(it);
+    }
+    st.calls_ended.pop_front();
+  }
+
+  if (m.at - st.calls_swept < std::chrono::minutes(1)) return;
+  st.calls_swept = m.at;
+  for (auto it = st.calls.begin(); it != st.calls.end();) {
+    const CallLog& c = it->second;
+    bool idle = m.at - c.last_event > kIdleCallTtl &&
+                std::none_of(c.channels.begin(), c.channels.end(),
+                             [&](const std::string& ch) { return st.find_channel(ch) != nullptr; });
+    if (!idle) {
+      ++it;
+      continue;
+    }
+    st.qa_decided.erase(it->first);
+    it = st.calls.erase(it);
+  }
+}
+
+static void record_history(StateStore& st, ChannelInfo& c, std::string_view event, const AmiMessage& m) {
+  if (c.history == ChanHistoryPool::kNone) c.history = st.history.acquire();
+  ChanEvent e;
+  e.at = m.at;
+  std::snprintf(e.type, sizeof(e.type), "%.*s", (int)event.size(), event.data());
+  history_detail(event, m, e.detail, sizeof(e.detail));
+  st.history.slots[c.history].push(e);
+}
+
+static void apply_event(StateStore& st, const AppConfig& cfg, const AmiMessage& m) {
+  auto get = [&](const char* k) -> std::string {
+    auto it = m.kv.find(k);
+    return it == m.kv.end() ? std::string() : std::string(it->second);
+  };
+  // For values only compared or copied into existing state: no string of its own
+  auto view = [&](const char* k) -> std::string_view {
+    auto it = m.kv.find(k);
+    return it == m.kv.end() ? std::string_view() : std::string_view(it->second);
+  };
+
+  const std::string_view event = view("Event");
+  if (event.empty()) return;
+  if (m.stamped) st.note_event_lag(m.at);
+  apply_event_chan_vars(st, cfg, m);
+  record_timeline(st, event, m);
+  // Resync listings restate known channels; they are not part of a channel's history
+  if (event != "Newchannel" && event != "CoreShowChannel") {
+    auto cit = m.kv.find("Channel");
+    if (cit != m.kv.end()) {
+      if (ChannelInfo* c = st.find_channel(cit->second)) record_history(st, *c, event, m);
+    }
+  }
+
+  // Channel lifecycle and metadata
+  if (event == "Newchannel") {
+    ChannelInfo ci;
+    ci.channel = get("Channel");
+    ci.uniqueid = get("Uniqueid");
+    ci.linkedid = get("Linkedid");
+    ci.caller_num = get("CallerIDNum");
+    ci.caller_name = get("CallerIDName");
+    ci.context = get("Context");
+    ci.exten = get("Exten");
+    ci.channelstate = get("ChannelState");
+    ci.state_desc = get("ChannelStateDesc");
+    parse_tech_peer(ci.channel, ci.tech, ci.peer);
+    apply_chan_vars(ci, get("ChanVariable"));
+    classify_channel(ci, cfg);
+
+    ci.created = m.at;
+    ci.last_update = std::chrono::steady_clock::now();
+    auto old = st.channels_by_name.find(ci.channel);
+    if (old != st.channels_by_name.end()) {
+      st.unindex_peer(old->second);
+      ci.history = old->second.history;
+    }
+    record_history(st, ci, event, m);
+    st.index_peer(ci);
+    st.channels_by_name[ci.channel] = ci;
+    if (!ci.uniqueid.empty()) st.chan_by_uniqueid[ci.uniqueid] = ci.channel;
+    st.log_line("Newchannel: " + ci.channel);
+
+    auto sit = st.spy_sessions.find(ci.uniqueid);
+    if (sit != st.spy_sessions.end()) {
+      sit->second.spy_channel = ci.channel;
+      sit->second.state = "ringing";
+    } else if (st.spy_cancelled.erase(ci.uniqueid)) {
+      st.outbox.push_back({"Hangup", {{"Channel", ci.channel}}});
+    }
+    return;
+  }
+
+  if (event == "Rename") {
+    std::string oldn = get("Oldname");
+    std::string newn = get("Newname");
+    if (!oldn.empty() && !newn.empty()) {
+      auto it = st.channels_by_name.find(oldn);
+      if (it != st.channels_by_name.end()) {
+        ChannelInfo ci = it->second;
+        st.unindex_peer(ci);
+        st.channels_by_name.erase(it);
+        ci.channel = newn;
+        parse_tech_peer(ci.channel, ci.tech, ci.peer);
+        classify_channel(ci, cfg);
+        st.index_peer(ci);
+        st.channels_by_name[newn] = ci;
+
+        // Update any bridge memberships
+        for (auto& [bid, b] : st.bridges) {
+          if (b.channels.erase(oldn)) b.channels.insert(newn);
+        }
+        for (auto& [uid, sp] : st.spy_sessions) {
+          if (sp.spy_channel == oldn) sp.spy_channel = newn;
+          if (sp.target_channel == oldn) sp.target_channel = newn;
+        }
+        auto tit = st.spy_by_target.find(oldn);
+        if (tit != st.spy_by_target.end()) {
+          std::string uid = tit->second;
+          st.spy_by_target.erase(tit);
+          st.spy_by_target[newn] = uid;
+        }
+        st.log_line("Rename: " + oldn + " -> " + newn);
+      }
+    }
+    return;
+  }
+
+  if (event == "Newstate") {
+    std::string_view ch = view("Channel");
+    if (ChannelInfo* c = st.find_channel(ch)) {
+      c->channelstate = view("ChannelState");
+      c->state_desc = view("ChannelStateDesc");
+      c->last_update = std::chrono::steady_clock::now();
+    }
+    if (view("ChannelState") == "6") {
+      SpySession* sp = find_spy_by_channel(st, ch);
+      if (sp && sp->state == "ringing") sp->state = "answered";
+    }
+    return;
+  }
+
+  if (event == "NewCallerid") {
+    std::string ch = get("Channel");
+    auto it = st.channels_by_name.find(ch);
+    if (it != st.channels_by_name.end()) {
+      it->second.caller_num = get("CallerIDNum");
+      it->second.caller_name = get("CallerIDName");
+      classify_channel(it->second, cfg);
+      it->second.last_update = std::chrono::steady_clock::now();
+    }
+    return;
+  }
+
+  if (event == "Newexten") {
+    auto cit = m.kv.find("Channel");
+    ChannelInfo* c = cit == m.kv.end() ? nullptr : st.find_channel(cit->second);
+    if (!c) return;
+    if (cfg.dialplan_profile) profile_newexten(st, *c, m);
+    else c->step.clear();
+    return;
+  }
+
+  if (event == "DeviceStateChange") {
+    std::string dev = get("Device");
+    if (!dev.empty()) st.devices.set(st.devices.intern(dev), parse_device_state(get("State")));
+    return;
+  }
+
+  if (event == "ExtensionStatus") {
+    // Hint "PJSIP/1001&Custom:DND1001": the first device is the phone the extension lives on
+    std::string hint = get("Hint");
+    std::string dev = hint.substr(0, hint.find('&'));
+    if (dev.empty()) dev = get("Exten") + "@" + get("Context");
+    uint32_t id = st.devices.intern(dev);
+    st.devices.slots[id].exten = get("Exten");
+    st.devices.set(id, parse_extension_status(to_int_safe(get("Status"))));
+    return;
+  }
+
+  if (event == "ContactStatus") {
+    std::string ep = get("EndpointName");
+    apply_contact_status(st, ep.empty() ? get("AOR") : ep, get("URI"), get("ContactStatus"), get("RoundtripUsec"),
+                         m.at);
+    return;
+  }
+
+  if (event == "ContactList") {
+    std::string ep = get("Endpoint");
+    apply_contact_status(st, ep.empty() ? get("Aor") : ep, get("Uri"), get("Status"), get("RoundtripUsec"), m.at);
+    return;
+  }
+
+  if (event == "QueueCallerLeave" || event == "QueueCallerAbandon" || event == "AgentConnect" ||
+      event == "AgentComplete") {
+    apply_queue_event(st, cfg, event, m);
+    return;
+  }
+
+  if (event == "QueueCallerJoin") {
+    apply_queue_event(st, cfg, event, m);
+    auto it = st.channels_by_name.find(get("Channel"));
+    if (it == st.channels_by_name.end()) return;
+    st.unindex_queue(it->second);
+    it->second.queue = get("Queue");
+    if (!it->second.queue.empty()) st.channels_by_queue[it->second.queue].insert(it->second.channel);
+    return;
+  }
+
+  if (event == "MixMonitorStart" || event == "MixMonitorStop" || event == "MixMonitorMute") {
+    std::string ch = get("Channel");
+    auto it = st.channels_by_name.find(ch);
+    if (it == st.channels_by_name.end()) return;
+    std::string& rec = it->second.rec;
+    if (event == "MixMonitorStart") rec = "recording";
+    else if (event == "MixMonitorStop") rec.clear();
+    else rec = get("State") == "1" ? "paused" : "recording";
+    st.log_line("Recording " + (rec.empty() ? std::string("stopped") : rec) + ": " + ch);
+    return;
+  }
+
+  if (event == "VarSet") {
+    std::string_view var = view("Variable");
+    if (ChannelInfo* c = st.find_channel(view("Channel"))) {
+      if (var == "CALL_DIR" || var == "__CALL_DIR") {
+        c->call_dir = view("Value");
+        classify_channel(*c, cfg);
+      }
+      c->last_update = std::chrono::steady_clock::now();
+    }
+    return;
+  }
+
+  if (event == "Hangup") {
+    std::string ch = get("Channel");
+    // remove from bridges
+    for (auto& [bid, b] : st.bridges) b.channels.erase(ch);
+    auto it = st.channels_by_name.find(ch);
+    if (it != st.channels_by_name.end()) {
+      count_hangup_cause(st, cfg, it->second, m);
+      st.unindex_peer(it->second);
+      st.unindex_queue(it->second);
+      if (!it->second.queue.empty()) {
+        auto qit = st.queues.find(it->second.queue);
+        if (qit != st.queues.end()) qit->second.leave(it->second.uniqueid);
+      }
+      st.history.release(it->second.history);
+      st.channels_by_name.erase(it);
+    }
+    st.log_line("Hangup: " + ch);
+
+    // Spy sessions end with either leg; a spy left behind by its target is hung up too
+    if (SpySession* sp = find_spy_by_channel(st, ch)) {
+      end_spy_session(st, sp->spy_uniqueid, "supervisor hung up");
+    }
+    auto tit = st.spy_by_target.find(ch);
+    if (tit != st.spy_by_target.end()) {
+      auto sit = st.spy_sessions.find(tit->second);
+      if (sit != st.spy_sessions.end()) {
+        const SpySession& sp = sit->second;
+        if (sp.spy_channel.empty()) st.spy_cancelled[sp.spy_uniqueid] = std::chrono::steady_clock::now();
+        st.outbox.push_back({"Hangup", {{"Channel", sp.spy_channel.empty() ? sp.spy_uniqueid : sp.spy_channel}}});
+      }
+      end_spy_session(st, tit->second, "target hung up");
+    }
+    return;
+  }
+
+  if (event == "OriginateResponse") {
+    std::string aid = get("ActionID");
+    for (auto& [uid, sp] : st.spy_sessions) {
+      if (sp.action_id != aid) continue;
+      if (lower(get("Response")) == "success") {
+        if (sp.spy_channel.empty()) sp.spy_channel = get("Channel");
+        if (sp.state != "spying") sp.state = "answered";
+        st.log_line("Monitor " + sp.supervisor + " answered, spying on " + sp.target_channel);
+      } else {
+        // Reason is the originate result code: 1 hung up, 3 no answer, 5 busy, 8 congestion
+        std::string uid_copy = uid;
+        end_spy_session(st, uid_copy, "originate failed, reason " + get("Reason"));
+      }
+      break;
+    }
+    return;
+  }
+
+  if (event == "ChanSpyStart" || event == "ChanSpyStop") {
+    SpySession* sp = find_spy_by_channel(st, view("SpyerChannel"));
+    if (!sp) return;
+    if (event == "ChanSpyStart") {
+      sp->state = "spying";
+    } else {
+      sp->state = "answered"; // ChanSpy returned; the dialplan hangs the supervisor up next
+    }
+    return;
+  }
+
+  // Bridge lifecycle
+  if (event == "BridgeCreate") {
+    BridgeInfo bi;
+    bi.bridge_id = get("BridgeUniqueid");
+    bi.bridge_type = get("BridgeType");
+    bi.last_update = std::chrono::steady_clock::now();
+    st.bridges[bi.bridge_id] = bi;
+    st.log_line("BridgeCreate: " + bi.bridge_id);
+    return;
+  }
+
+  if (event == "BridgeDestroy") {
+    std::string bid = get("BridgeUniqueid");
+    st.bridges.erase(bid);
+    st.log_line("BridgeDestroy: " + bid);
+    return;
+  }
+
+  if (event == "BridgeEnter") {
+    std::string bid = get("BridgeUniqueid");
+    std::string ch = get("Channel");
+    auto& b = st.bridges[bid];
+    b.bridge_id = bid;
+    b.bridge_type = get("BridgeType");
+    b.channels.insert(ch);
+    b.last_update = std::chrono::steady_clock::now();
+    if (b.first_enter == std::chrono::steady_clock::time_point::min()) {
+      b.first_enter = m.at;
+    }
+    auto it = st.channels_by_name.find(ch);
+    if (it != st.channels_by_name.end()) {
+      it->second.bridge_id = bid;
+      if (cfg.codec_detect && !it->second.fmt_queued) {
+        it->second.fmt_queued = true;
+        st.fmt_wanted.push_back(ch);
+      }
+      qa_consider(st, cfg, b, it->second);
+    }
+    return;
+  }
+
+  if (event == "BridgeLeave") {
+    std::string bid = get("BridgeUniqueid");
+    std::string ch = get("Channel");
+    auto bit = st.bridges.find(bid);
+    if (bit != st.bridges.end()) {
+      bit->second.channels.erase(ch);
+      bit->second.last_update = std::chrono::steady_clock::now();
+    }
+    auto it = st.channels_by_name.find(ch);
+    if (it != st.channels_by_name.end()) it->second.bridge_id.clear();
+    return;
+  }
+
+  if (event == "CoreShowChannel" || event == "CoreShowChannelsComplete") {
+    apply_resync_event(st, cfg, event, m);
+    return;
+  }
+
+  // Optional: DialBegin/DialEnd could be used to refine direction and ring time if desired.
+}
+
+// "01:02:03" -> 3723
+static int parse_hms(const std::string& v) {
+  int h = 0, mi = 0, sec = 0;
+  if (std::sscanf(v.c_str(), "%d:%d:%d", &h, &mi, &sec) != 3) return 0;
+  return h * 3600 + mi * 60 + sec;
+}
+
+// Reconcile the store with one CoreShowChannels listing. Missing channels and bridge memberships
+// are replayed as the Newchannel/BridgeEnter/BridgeLeave they stand for; channels Asterisk no
+// longer has get a Hangup. Channels created after the listing started are left alone.
+static void apply_resync_event(StateStore& st, const AppConfig& cfg, std::string_view event, const AmiMessage& m) {
+  ChannelResync& rs = st.resync;
+  auto aid = m.kv.find("ActionID");
+  if (!rs.running || aid == m.kv.end() || std::string_view(aid->second) != rs.action.id) return;
+  auto get = [&](const char* k) -> std::string {
+    auto it = m.kv.find(k);
+    return it == m.kv.end() ? std::string() : std::string(it->second);
+  };
+  auto replay = [&](const char* ev, std::initializer_list<std::pair<const char*, std::string>> kv,
+                    std::chrono::steady_clock::time_point at) {
+    AmiMessage r;
+    r.kv["Event"] = ev;
+    for (const auto& [k, v] : kv) r.kv[k] = v;
+    r.received = m.received;
+    r.at = at;
+    apply_event(st, cfg, r);
+  };
+
+  if (event == "CoreShowChannel") {
     std::string ch = get("Channel");
-    std::string var = get("Variable");
-    std::string val = get("Value");
+    rs.seen.insert(ch);
+    // A bridge is no older than its channel; that is the best start time the listing gives
+    auto since = m.at - std::chrono::seconds(parse_hms(get("Duration")));
     auto it = st.channels_by_name.find(ch);
-    if (it != st.channels_by_name.end()) {
-      if (var == "CALL_DIR" || var == "__CALL_DIR") {
-        it->second.call_dir = val;
-      }
-      it->second.last_update = std::chrono::steady_clock::now();
+    if (it == st.channels_by_name.end()) {
+      AmiMessage r = m;
+      r.kv["Event"] = "Newchannel";
+      r.stamped = false;
+      r.at = since;
+      apply_event(st, cfg, r);
+      it = st.channels_by_name.find(ch);
+      if (it == st.channels_by_name.end()) return;
+      rs.added++;
     }
+    std::string bid = get("BridgeId");
+    if (it->second.bridge_id == bid) return;
+    if (!it->second.bridge_id.empty()) {
+      replay("BridgeLeave", {{"BridgeUniqueid", it->second.bridge_id}, {"Channel", ch}}, m.at);
+    }
+    if (!bid.empty()) replay("BridgeEnter", {{"BridgeUniqueid", bid}, {"Channel", ch}}, since);
     return;
   }
 
-  if (event == "Hangup") {
-    std::string ch = get("Channel");
-    // remove from bridges
-    for (auto& [bid, b] : st.bridges) b.channels.erase(ch);
-    st.channels_by_name.erase(ch);
-    st.log_line("Hangup: " + ch);
+  std::vector<std::string> gone;
+  for (const auto& [name, c] : st.channels_by_name) {
+    if (!rs.seen.count(name) && c.created < rs.started) gone.push_back(name);
+  }
+  for (const auto& name : gone) replay("Hangup", {{"Channel", name}}, m.at);
+  rs.removed += gone.size();
+  rs.running = false;
+  rs.seen.clear();
+  st.log_line("Resync: " + get("ListItems") + " channels listed, " + std::to_string(gone.size()) +
+              " stale removed");
+}
+
+// --- Taskprocessor sampler ---
+// One "core show taskprocessors" reply, line by line:
+//   Processor   Processed   In Queue   Max Depth   Low water   High water
+// Lines that don't parse as a row (header, blank, "N taskprocessors") are skipped.
+static void apply_taskproc_output(StateStore& st, const AppConfig& cfg, const std::string& out) {
+  TaskprocSampler& tp = st.taskprocs;
+  uint64_t sample = ++tp.samples;
+  std::istringstream in(out);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream ls(line);
+    std::string name;
+    uint64_t processed = 0;
+    uint32_t depth = 0, max_depth = 0, low = 0, high = 0;
+    if (!(ls >> name >> processed >> depth >> max_depth >> low >> high)) continue;
+
+    TaskprocSeries& s = tp.series[name];
+    s.rate = (s.seen && processed >= s.processed && tp.interval_s > 0) ? (processed - s.processed) / tp.interval_s : 0;
+    s.processed = processed;
+    s.max_depth = max_depth;
+    s.high_water = high;
+    s.seen = sample;
+    s.depth.push(depth);
+
+    // Alert on a deep queue, or on one that grew on each of the last three samples
+    bool rising = s.depth.size >= 4;
+    for (size_t i = s.depth.size - 3; rising && i < s.depth.size; i++) rising = s.depth.at(i) > s.depth.at(i - 1);
+    int floor = std::max(5, cfg.taskproc_alert_depth / 4);
+    bool alert = (int)depth >= cfg.taskproc_alert_depth || (rising && (int)depth >= floor);
+    if (alert && !s.alert) {
+      st.log_line("Taskprocessor " + name + " backing up: depth " + std::to_string(depth) + " (max " +
+                  std::to_string(max_depth) + ", high water " + std::to_string(high) + ")");
+    } else if (!alert && s.alert) {
+      st.log_line("Taskprocessor " + name + " recovered: depth " + std::to_string(depth));
+    }
+    s.alert = alert;
+  }
+  // Taskprocessors come and go with their owners (e.g. per-endpoint serializers)
+  for (auto it = tp.series.begin(); it != tp.series.end();) {
+    if (it->second.seen != sample) it = tp.series.erase(it);
+    else ++it;
+  }
+}
+
+// Called every UI loop iteration: collect finished replies, send the next request when due.
+// At most one request per node is outstanding.
+static void sample_taskprocessors(NodeList& nodes, const AppConfig& cfg) {
+  if (cfg.taskproc_sample_sec <= 0) return;
+  auto now = std::chrono::steady_clock::now();
+  for (auto& n : nodes) {
+    TaskprocSampler& tp = n->st.taskprocs;
+    if (tp.reply.valid()) {
+      if (tp.reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        AmiMessage r = tp.reply.get();
+        if (lower(r.kv["Response"]) == "success") {
+          apply_taskproc_output(n->st, cfg, std::string(r.kv["Output"]));
+        } else {
+          tp.failures++;
+          if (!tp.denied) {
+            tp.denied = true;
+            n->st.log_line("Taskprocessor sampling failed: " + std::string(r.kv["Message"]) + " (AMI user needs write=command)");
+          }
+        }
+      } else if (now - tp.sent > std::chrono::milliseconds(cfg.action_timeout_ms)) {
+        n->ami.cancel(tp.reply_id);
+        tp.reply = {};
+        tp.failures++;
+      }
+      continue;
+    }
+    if (!n->ami.connected()) continue;
+    if (tp.last != std::chrono::steady_clock::time_point::min() &&
+        now - tp.last < std::chrono::seconds(cfg.taskproc_sample_sec)) continue;
+    tp.interval_s = tp.last == std::chrono::steady_clock::time_point::min()
+                        ? 0 : std::chrono::duration<double>(now - tp.last).count();
+    tp.last = now;
+    try {
+      tp.reply = n->ami.request_async({"Command", {{"Command", "core show taskprocessors"}}}, tp.reply_id);
+      tp.sent = now;
+    } catch (const std::exception&) {
+      tp.failures++;
+    }
+  }
+}
+
+// --- Heartbeat ---
+// One Ping in flight per node. The round trip is measured to when the reader parsed the
+// Response, so the UI loop's polling delay does not count. A Ping unanswered by the next
+// interval is missed; PING_MISSES in a row declare the connection dead. The Ping goes on the event
+// connection, and with AMI_ACTION_CONN a second one on the action connection, so a half-open
+// socket on either is caught; the RTT is the event connection's.
+static void heartbeat(NodeList& nodes, const AppConfig& cfg) {
+  if (cfg.ping_interval_sec <= 0) return;
+  auto now = std::chrono::steady_clock::now();
+  auto interval = std::chrono::seconds(cfg.ping_interval_sec);
+  for (auto& n : nodes) {
+    Heartbeat& hb = n->st.heartbeat;
+    if (hb.reply.valid() || hb.act_reply.valid()) {
+      for (bool event_lane : {true, false}) {
+        auto& reply = event_lane ? hb.reply : hb.act_reply;
+        if (!reply.valid()) continue;
+        if (reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+          AmiMessage r = reply.get();
+          if (event_lane && lower(r.kv["Response"]) == "success") {
+            hb.last_rtt_us = std::chrono::duration_cast<std::chrono::microseconds>(r.received - hb.sent).count();
+            hb.rtt.add(hb.last_rtt_us, now, interval * kPingRttIntervals);
+          }
+        } else if (now - hb.sent >= interval) {
+          n->ami.cancel(event_lane ? hb.reply_id : hb.act_reply_id);
+          reply = {};
+          hb.round_lost = true;
+        }
+      }
+      if (hb.reply.valid() || hb.act_reply.valid()) continue;
+      if (!hb.round_lost) {
+        hb.missed = 0;
+      } else {
+        hb.lost++;
+        if (++hb.missed >= cfg.ping_misses) {
+          n->st.log_line("AMI heartbeat: " + std::to_string(hb.missed) + " pings unanswered, reconnecting");
+          hb.missed = 0;
+          hb.dead++;
+          n->ami.drop_connection();
+        }
+      }
+    }
+    if (!n->ami.connected()) continue;
+    if (hb.last != std::chrono::steady_clock::time_point::min() && now - hb.last < interval) continue;
+    hb.last = now;
+    hb.round_lost = false;
+    try {
+      hb.sent = now;
+      hb.reply = n->ami.request_async({"Ping", {}}, hb.reply_id, true, true);
+      hb.pings++;
+      if (n->ami.has_action_lane()) hb.act_reply = n->ami.request_async({"Ping", {}}, hb.act_reply_id, true);
+    } catch (const std::exception&) {
+      // A failed write is a dead socket too; the reader notices it on its own
+    }
+  }
+}
+
+// --- Event loss ---
+// Report sequence gaps and queue overflows, and start a rate-limited channel resync on a node
+// that lost events. Lost events are counted by the reader; this runs on the UI thread.
+static void resync_channels(NodeList& nodes, const AppConfig& cfg) {
+  auto now = std::chrono::steady_clock::now();
+  for (auto& n : nodes) {
+    ChannelResync& rs = n->st.resync;
+    uint64_t gaps = n->ami.seq_gaps(), dropped = n->ami.queue_dropped();
+    if (gaps != rs.gaps_logged || dropped != rs.dropped_logged) {
+      n->st.log_line("Lost events: " + std::to_string(gaps - rs.gaps_logged) + " sequence gaps (" +
+                     std::to_string(n->ami.seq_missing()) + " events missing in total), " +
+                     std::to_string(dropped - rs.dropped_logged) + " dropped on queue overflow");
+      rs.gaps_logged = gaps;
+      rs.dropped_logged = dropped;
+    }
+    if (n->ami.take_resync_request()) rs.pending = true;
+
+    if (rs.running) {
+      if (now - rs.started < std::chrono::seconds(30)) continue;
+      n->st.log_line("Resync: no CoreShowChannelsComplete within 30s, giving up");
+      n->ami.cancel(rs.action);
+      rs.running = false;
+      rs.seen.clear();
+    }
+    if (!rs.pending || !n->ami.connected()) continue;
+    if (rs.last != std::chrono::steady_clock::time_point::min() &&
+        now - rs.last < std::chrono::seconds(cfg.resync_min_sec)) continue;
+    try {
+      rs.action = n->ami.send_tracked({"CoreShowChannels", {}});
+    } catch (const std::exception& e) {
+      n->st.log_line(std::string("Resync: CoreShowChannels not sent: ") + e.what());
+      rs.last = now;
+      continue;
+    }
+    rs.pending = false;
+    rs.running = true;
+    rs.started = rs.last = now;
+    rs.runs++;
+  }
+}
+
+// --- Transcoding detector ---
+// "(ulaw)" -> "ulaw". Multi-format values like "(ulaw|alaw)" are kept as they are inside.
+static std::string strip_parens(std::string v) {
+  if (v.size() >= 2 && v.front() == '(' && v.back() == ')') v = v.substr(1, v.size() - 2);
+  return v;
+}
+
+// A leg translates when Asterisk reads or writes it in a format other than its native one
+static bool leg_translates(const ChannelInfo& c) {
+  if (c.fmt_native.empty()) return false;
+  return (!c.fmt_read.empty() && c.fmt_read != c.fmt_native) ||
+         (!c.fmt_write.empty() && c.fmt_write != c.fmt_native);
+}
+
+// Native codecs of a bridge's legs, and whether audio is transcoded between or on them
+static bool bridge_transcodes(const StateStore& st, const BridgeInfo& b, std::set<std::string>& codecs) {
+  bool translates = false;
+  for (const auto& ch : b.channels) {
+    auto it = st.channels_by_name.find(ch);
+    if (it == st.channels_by_name.end() || it->second.fmt_native.empty()) continue;
+    codecs.insert(it->second.fmt_native);
+    translates = translates || leg_translates(it->second);
+  }
+  return codecs.size() > 1 || translates;
+}
+
+// Called every UI loop iteration: store finished Getvar replies, then top up the pipeline from
+// the wanted queue. Requests are written back to back; nothing waits for a reply.
+static void fetch_codec_formats(NodeList& nodes, const AppConfig& cfg) {
+  auto now = std::chrono::steady_clock::now();
+  for (auto& n : nodes) {
+    StateStore& st = n->st;
+    for (size_t i = 0; i < st.fmt_inflight.size();) {
+      FormatQuery& q = st.fmt_inflight[i];
+      if (q.reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        AmiMessage r = q.reply.get();
+        auto cit = st.channels_by_name.find(q.channel);
+        if (cit != st.channels_by_name.end() && lower(r.kv["Response"]) == "success") {
+          std::string v = strip_parens(std::string(r.kv["Value"]));
+          if (q.var == "audionativeformat") cit->second.fmt_native = v;
+          else if (q.var == "audioreadformat") cit->second.fmt_read = v;
+          else cit->second.fmt_write = v;
+        }
+      } else if (now - q.sent > std::chrono::milliseconds(cfg.action_timeout_ms)) {
+        n->ami.cancel(q.id);
+      } else {
+        i++;
+        continue;
+      }
+      st.fmt_inflight[i] = std::move(st.fmt_inflight.back());
+      st.fmt_inflight.pop_back();
+    }
+
+    if (!cfg.codec_detect) {
+      st.fmt_wanted.clear();
+      continue;
+    }
+    while (!st.fmt_wanted.empty() && st.fmt_inflight.size() + 3 <= kMaxFormatQueries && n->ami.connected()) {
+      std::string ch = std::move(st.fmt_wanted.front());
+      st.fmt_wanted.pop_front();
+      if (!st.channels_by_name.count(ch)) continue; // hung up while queued
+      try {
+        for (const char* var : {"audionativeformat", "audioreadformat", "audiowriteformat"}) {
+          FormatQuery q;
+          q.channel = ch;
+          q.var = var;
+          q.reply = n->ami.request_async({"Getvar", {{"Channel", ch}, {"Variable", std::string("CHANNEL(") + var + ")"}}}, q.id);
+          q.sent = now;
+          st.fmt_inflight.push_back(std::move(q));
+        }
+      } catch (const std::exception& ex) {
+        st.log_line("Codec lookup not sent for " + ch + ": " + ex.what());
+        break;
+      }
+    }
+  }
+}
+
+// --- TUI ---
+struct BridgeRow {
+  std::string bridge_id;
+  std::string node;
+  int node_index = 0;
+  std::string dir;
+  int duration_sec = 0;
+  int participants = 0;
+  std::string rec; // REC if any member is recording, PAUS if only paused ones
+  std::vector<std::string> member_channels;
+  std::string summary;
+};
+
+static void append_bridge_rows(const StateStore& st, int node_index, const UiState& ui, std::vector<BridgeRow>& rows) {
+  for (const auto& [bid, b] : st.bridges) {
+    if (b.channels.empty()) continue;
+
+    BridgeRow r;
+    r.bridge_id = bid;
+    r.node = st.node;
+    r.node_index = node_index;
+    r.duration_sec = secs_since(b.first_enter);
+    r.participants = (int)b.channels.size();
+    r.member_channels.assign(b.channels.begin(), b.channels.end());
+
+    // Determine direction by looking at member channels classifications
+    std::map<std::string, int> counts;
+    for (const auto& ch : r.member_channels) {
+      auto it = st.channels_by_name.find(ch);
+      if (it == st.channels_by_name.end()) continue;
+      counts[it->second.dir]++;
+      if (it->second.rec == "recording") r.rec = "REC";
+      else if (it->second.rec == "paused" && r.rec.empty()) r.rec = "PAUS";
+    }
+    std::string dir = "unknown";
+    int best = 0;
+    for (auto& kv : counts) {
+      if (kv.second > best) { best = kv.second; dir = kv.first; }
+    }
+    r.dir = dir;
+
+    // Apply filter
+    if (lower(ui.filter) != "all" && lower(ui.filter) != lower(r.dir)) continue;
+
+    // Build human summary: try to pick 1-2 legs with caller->connected
+    std::ostringstream sum;
+    int shown = 0;
+    for (const auto& ch : r.member_channels) {
+      auto it = st.channels_by_name.find(ch);
+      if (it == st.channels_by_name.end()) continue;
+      const auto& c = it->second;
+
+      std::string caller = c.caller_num.empty() ? "unknown" : c.caller_num;
+      std::string conn = c.connected_num.empty() ? "unknown" : c.connected_num;
+      if (caller == "unknown" && conn == "unknown") continue;
+
+      sum << c.tech << "/" << c.peer << " " << caller << "->" << conn << "  ";
+      if (++shown >= 2) break;
+    }
+    std::set<std::string> codecs;
+    if (bridge_transcodes(st, b, codecs)) {
+      sum << "[XCODE";
+      for (const auto& c : codecs) sum << " " << c;
+      sum << "]  ";
+    }
+    for (const auto& ch : r.member_channels) {
+      auto sit = st.spy_by_target.find(ch);
+      if (sit == st.spy_by_target.end()) continue;
+      auto sp = st.spy_sessions.find(sit->second);
+      if (sp != st.spy_sessions.end()) {
+        sum << (sp->second.qa ? "[QA " : "[SPY ") << sp->second.supervisor << " " << sp->second.mode << " " << sp->second.state << "]  ";
+      }
+    }
+    r.summary = sum.str();
+    rows.push_back(std::move(r));
+  }
+}
+
+// Merge every node's shard into one call list, ordered by ui.sort.
+static std::vector<BridgeRow> build_bridge_rows(const NodeList& nodes, const UiState& ui) {
+  size_t total = 0;
+  for (const auto& n : nodes) total += n->st.bridges.size();
+  std::vector<BridgeRow> rows;
+  rows.reserve(total);
+
+  for (int i = 0; i < (int)nodes.size(); i++) append_bridge_rows(nodes[i]->st, i, ui, rows);
+
+  // Longest duration first is the tie-breaker for every ordering (more relevant)
+  auto by_duration = [](const BridgeRow& a, const BridgeRow& b) { return a.duration_sec > b.duration_sec; };
+  if (ui.sort == "node") {
+    std::sort(rows.begin(), rows.end(), [&](const BridgeRow& a, const BridgeRow& b) {
+      return a.node != b.node ? a.node < b.node : by_duration(a, b);
+    });
+  } else if (ui.sort == "direction") {
+    std::sort(rows.begin(), rows.end(), [&](const BridgeRow& a, const BridgeRow& b) {
+      return a.dir != b.dir ? a.dir < b.dir : by_duration(a, b);
+    });
+  } else if (ui.sort == "parts") {
+    std::sort(rows.begin(), rows.end(), [&](const BridgeRow& a, const BridgeRow& b) {
+      return a.participants != b.participants ? a.participants > b.participants : by_duration(a, b);
+    });
+  } else {
+    std::sort(rows.begin(), rows.end(), by_duration);
+  }
+
+  return rows;
+}
+
+static std::string node_health_summary(const NodeList& nodes) {
+  std::ostringstream oss;
+  for (const auto& n : nodes) {
+    int calls = 0;
+    for (const auto& [bid, b] : n->st.bridges) if (!b.channels.empty()) calls++;
+    oss << "  " << n->st.node << ":";
+    if (!n->ami.connected()) {
+      oss << "DOWN";
+    } else {
+      int idle = n->ami.secs_since_last_message();
+      oss << "up " << calls << " calls";
+      if (idle >= 0) oss << " " << idle << "s";
+      if (n->st.stamped_events) oss << " lag " << fmt_us(n->st.last_lag_us > 0 ? n->st.last_lag_us : 0);
+      const Heartbeat& hb = n->st.heartbeat;
+      if (hb.last_rtt_us) {
+        LatencyHistogram h = hb.rtt.merged();
+        oss << " ping " << fmt_us(hb.last_rtt_us) << " p50 " << fmt_us(h.percentile_us(50)) << " p99 "
+            << fmt_us(h.percentile_us(99));
+        if (hb.missed) oss << " MISSED " << hb.missed;
+      }
+    }
+  }
+  return oss.str();
+}
+
+// Aggregate progress of the bulk jobs still shown in the header
+static std::string bulk_progress(const UiState& ui) {
+  if (ui.bulk_jobs.empty()) return "";
+  int total = 0, sent = 0, ok = 0, failed = 0;
+  bool running = false;
+  int64_t ms = 0;
+  for (const auto& j : ui.bulk_jobs) {
+    total += j->total();
+    sent += j->sent.load();
+    ok += j->ok.load();
+    failed += j->failed.load();
+    if (!j->done.load()) running = true;
+    ms = std::max<int64_t>(ms, j->done.load() ? j->elapsed_ms.load()
+        : std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - j->started).count());
+  }
+  std::ostringstream oss;
+  oss << "  Bulk " << ui.bulk_jobs.front()->label << ": " << (ok + failed) << "/" << total
+      << " (sent " << sent << ", ok " << ok << ", failed " << failed << ") "
+      << ms << "ms" << (running ? "" : " done");
+  return oss.str();
+}
+
+// Service level as "85%", or "-" before any call was answered or abandoned in the window
+static std::string fmt_sl(QueueWindow& w, std::chrono::steady_clock::time_point now) {
+  uint64_t total = w.answered.sum(now) + w.abandoned.sum(now);
+  if (total == 0) return "-";
+  return std::to_string(w.answered_in_sl.sum(now) * 100 / total) + "%";
+}
+
+// Rows y0..y1 from column x: one line per queue, busiest first
+static void draw_queue_panel(const NodeList& nodes, int y0, int x, int y1) {
+  auto now = std::chrono::steady_clock::now();
+  struct Row {
+    std::string name;
+    QueueStats* q;
+  };
+  std::vector<Row> rows;
+  for (const auto& n : nodes) {
+    for (auto& [name, q] : n->st.queues) {
+      rows.push_back({nodes.size() > 1 ? n->st.node.substr(0, 6) + ":" + name : name, &q});
+    }
+  }
+  std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+    if (a.q->waiting.size() != b.q->waiting.size()) return a.q->waiting.size() > b.q->waiting.size();
+    return a.name < b.name;
+  });
+
+  mvvline(y0, x, ACS_VLINE, y1 - y0 + 1);
+  std::ostringstream hdr;
+  hdr << std::left << std::setw(14) << "QUEUE" << std::right << std::setw(5) << "WAIT" << std::setw(8) << "LONGEST"
+      << std::setw(6) << "SL5m" << std::setw(6) << "SL1h" << std::setw(8) << "ABND1h";
+  mvprintw(y0, x + 2, "%s", hdr.str().c_str());
+  int y = y0 + 1;
+  for (const auto& r : rows) {
+    if (y > y1) break;
+    QueueStats& q = *r.q;
+    int longest = q.waiting.empty() ? 0 : secs_since(q.waiting.front().joined);
+    std::ostringstream line;
+    line << std::left << std::setw(14) << r.name.substr(0, 13) << std::right << std::setw(5) << q.waiting.size()
+         << std::setw(8) << (q.waiting.empty() ? "-" : std::to_string(longest) + "s") << std::setw(6)
+         << fmt_sl(q.last5m, now) << std::setw(6) << fmt_sl(q.last1h, now) << std::setw(8)
+         << q.last1h.abandoned.sum(now);
+    bool hot = !q.waiting.empty() && longest >= 60;
+    if (hot) attron(A_BOLD);
+    mvprintw(y++, x + 2, "%s", line.str().c_str());
+    if (hot) attroff(A_BOLD);
+  }
+}
+
+static void tui_draw(const NodeList& nodes, UiState& ui) {
+  erase();
+  int maxy, maxx;
+  getmaxyx(stdscr, maxy, maxx);
+
+  mvprintw(0, 0, "Asterisk AMI Call Monitor (Asterisk 20 / PJSIP)  Filter: %s  Sort: %s  Time: %s",
+           ui.filter.c_str(), ui.sort.c_str(), now_ts().c_str());
+  if (!ui.quarantine_active.empty()) {
+    std::string q;
+    for (const auto& p : ui.quarantine_active) q += (q.empty() ? "" : ",") + p;
+    attron(A_BOLD);
+    printw("  QUARANTINE: %s", q.c_str());
+    attroff(A_BOLD);
+  }
+  std::string tp_alerts;
+  for (const auto& n : nodes) {
+    for (const auto& [name, s] : n->st.taskprocs.series) {
+      if (s.alert) tp_alerts += (tp_alerts.empty() ? "" : ",") + name;
+    }
+  }
+  if (!tp_alerts.empty()) {
+    attron(A_BOLD);
+    printw("  TASKPROCESSOR ALERT: %s", tp_alerts.c_str());
+    attroff(A_BOLD);
+  }
+  std::string spikes;
+  for (const auto& n : nodes) {
+    for (const auto& [key, tc] : n->st.hangup_causes) {
+      for (const auto& [cause, cc] : tc.causes) {
+        bool recent = cc.spike_at != std::chrono::steady_clock::time_point::min() && secs_since(cc.spike_at) < 60;
+        if (recent) spikes += (spikes.empty() ? "" : ",") + key + " " + std::to_string(cause);
+      }
+    }
+  }
+  if (!spikes.empty()) {
+    attron(A_BOLD);
+    printw("  CAUSE SPIKE: %s", spikes.c_str());
+    attroff(A_BOLD);
+  }
+
+  mvprintw(1, 0, "Keys: [Up/Down]=Select Call  [Tab]=Select Member  [Enter]=Member events  [I]=Call timeline  [F]=Filter  [O]=Sort  [H]=Hangup Member  [K]=Kick Member  [B]=Destroy Bridge");
+  mvprintw(2, 0, "      [M/1]=Listen [2]=Whisper [3]=Barge [0]=End monitor  [X]=Hang up all filtered calls  [T]=Quarantine trunk  [L]=Logs  [S]=Stats  [C]=Causes  [Q]=Quit");
+  mvprintw(3, 0, "      [R]=Record member  [U]=Pause/resume recording  [A]=Record all calls on this trunk/queue  [P]=Dialplan profile  [Y]=Taskprocessors  [E]=Endpoints  [D]=Devices");
+
+  auto rows = build_bridge_rows(nodes, ui);
+  bool multi = nodes.size() > 1;
+
+  int list_start = 5;
+  std::string health = "Calls (bridges): " + std::to_string(rows.size()) + "  Nodes:" + node_health_summary(nodes) + bulk_progress(ui);
+  if ((int)health.size() > maxx - 1) health.resize(maxx - 1);
+  mvprintw(list_start - 1, 0, "%s", health.c_str());
+  mvhline(list_start, 0, ACS_HLINE, maxx);
+
+  // Queue panel on the right of the call list, when there are queues and room for both
+  bool any_queue = false;
+  for (const auto& n : nodes) any_queue = any_queue || !n->st.queues.empty();
+  const int panel_w = any_queue && maxx >= 140 ? 50 : 0;
+  const int list_w = maxx - panel_w;
+  if (panel_w) draw_queue_panel(nodes, list_start + 1, list_w, maxy - 9);
+
+  int y = list_start + 1;
+  int idx = 0;
+  for (; idx < (int)rows.size() && y < maxy - 8; idx++, y++) {
+    const auto& r = rows[idx];
+    bool sel = (idx == ui.selected_bridge_index);
+    if (sel) attron(A_REVERSE);
+
+    std::ostringstream line;
+    line << std::setw(3) << idx + 1 << "  ";
+    if (multi) line << std::left << std::setw(10) << r.node.substr(0, 10) << std::right << "  ";
+    line << std::setw(8) << (std::to_string(r.duration_sec) + "s") << "  "
+         << std::setw(9) << r.dir << "  "
+         << std::setw(4) << r.rec << "  "
+         << "parts=" << r.participants << "  "
+         << r.bridge_id.substr(0, 12) << "…  "
+         << r.summary;
+
+    std::string s = line.str();
+    if ((int)s.size() > list_w - 1) s.resize(list_w - 1);
+    mvprintw(y, 0, "%s", s.c_str());
+
+    if (sel) attroff(A_REVERSE);
+  }
+
+  // Selected call details
+  int detail_y = maxy - 7;
+  mvhline(detail_y - 1, 0, ACS_HLINE, maxx);
+  mvprintw(detail_y, 0, "Selected Call Details:");
+
+  if (!rows.empty()) {
+    ui.selected_bridge_index = std::max(0, std::min(ui.selected_bridge_index, (int)rows.size() - 1));
+    const auto& sel = rows[ui.selected_bridge_index];
+    const StateStore& st = nodes[sel.node_index]->st;
+
+    mvprintw(detail_y + 1, 0, "BridgeUniqueid: %s   Node: %s", sel.bridge_id.c_str(), sel.node.c_str());
+    mvprintw(detail_y + 2, 0, "Direction: %s   Duration: %ds   Participants: %d",
+             sel.dir.c_str(), sel.duration_sec, sel.participants);
+
+    mvprintw(detail_y + 3, 0, "Members:");
+    int my = detail_y + 4;
+
+    int mindex = 0;
+    ui.selected_member_index = std::max(0, std::min(ui.selected_member_index, (int)sel.member_channels.size() - 1));
+
+    for (; mindex < (int)sel.member_channels.size() && my < maxy - 1; mindex++, my++) {
+      const std::string& ch = sel.member_channels[mindex];
+      auto it = st.channels_by_name.find(ch);
+
+      std::ostringstream ml;
+      ml << (mindex == ui.selected_member_index ? " > " : "   ")
+         << ch;
+
+      if (it != st.channels_by_name.end()) {
+        const auto& c = it->second;
+        ml << "  [" << c.dir << "]"
+           << "  CID:" << (c.caller_num.empty() ? "?" : c.caller_num)
+           << "  CONN:" << (c.connected_num.empty() ? "?" : c.connected_num)
+           << "  STATE:" << (c.state_desc.empty() ? "?" : c.state_desc);
+        if (!c.queue.empty()) ml << "  Q:" << c.queue;
+        if (!c.rec.empty()) ml << "  " << (c.rec == "paused" ? "REC(paused)" : "REC");
+        auto eit = st.endpoints.find(c.peer);
+        if (eit != st.endpoints.end()) {
+          if (eit->second.status == "unreachable") ml << "  UNREACHABLE";
+          else if (eit->second.last_rtt_us) ml << "  RTT:" << fmt_us(eit->second.last_rtt_us);
+        }
+        if (!c.fmt_native.empty()) {
+          ml << "  CODEC:" << c.fmt_native;
+          if (leg_translates(c)) ml << "(r:" << c.fmt_read << " w:" << c.fmt_write << ")";
+        }
+      }
+      auto sit = st.spy_by_target.find(ch);
+      if (sit != st.spy_by_target.end()) {
+        auto sp = st.spy_sessions.find(sit->second);
+        if (sp != st.spy_sessions.end()) {
+          ml << "  SPY:" << sp->second.supervisor << "(" << sp->second.mode << ", " << sp->second.state << ", "
+             << secs_since(sp->second.started) << "s)";
+        }
+      }
+
+      std::string ms = ml.str();
+      if ((int)ms.size() > maxx - 1) ms.resize(maxx - 1);
+      mvprintw(my, 0, "%s", ms.c_str());
+    }
+  } else {
+    mvprintw(detail_y + 1, 0, "No active bridges detected. Ensure calls are being bridged and AMI events are enabled.");
+  }
+
+  refresh();
+}
+
+// One-line y/N question on the bottom row. Blocks until a key is pressed.
+static bool tui_confirm(const std::string& question) {
+  int maxy, maxx;
+  getmaxyx(stdscr, maxy, maxx);
+  std::string q = question + " [y/N]";
+  if ((int)q.size() > maxx - 1) q.resize(maxx - 1);
+  move(maxy - 1, 0);
+  clrtoeol();
+  attron(A_REVERSE);
+  mvprintw(maxy - 1, 0, "%s", q.c_str());
+  attroff(A_REVERSE);
+  refresh();
+  nodelay(stdscr, FALSE);
+  int ch = getch();
+  nodelay(stdscr, TRUE);
+  return ch == 'y' || ch == 'Y';
+}
+
+static void tui_show_logs(const AuditLog& log) {
+  erase();
+  int maxy, maxx;
+  getmaxyx(stdscr, maxy, maxx);
+
+  mvprintw(0, 0, "Audit / Event Log (press any key to return)");
+  mvhline(1, 0, ACS_HLINE, maxx);
+
+  int start = std::max(0, (int)log.lines.size() - (maxy - 3));
+  int y = 2;
+  for (int i = start; i < (int)log.lines.size() && y < maxy; i++, y++) {
+    std::string s = log.lines[i];
+    if ((int)s.size() > maxx - 1) s.resize(maxx - 1);
+    mvprintw(y, 0, "%s", s.c_str());
+  }
+  refresh();
+}
+
+static void tui_show_history(const NodeList& nodes, const UiState& ui) {
+  erase();
+  int maxy, maxx;
+  getmaxyx(stdscr, maxy, maxx);
+
+  mvprintw(0, 0, "Recent events of %s (press any key to return)   Time: %s", ui.history_channel.c_str(), now_ts().c_str());
+  mvhline(1, 0, ACS_HLINE, maxx);
+  if (ui.history_node >= (int)nodes.size()) return;
+  const StateStore& st = nodes[ui.history_node]->st;
+  auto it = st.channels_by_name.find(ui.history_channel);
+  if (it == st.channels_by_name.end()) {
+    mvprintw(2, 0, "The channel has hung up; its history was released. See the audit log (L).");
+    refresh();
     return;
   }
-
-  // Bridge lifecycle
-  if (event == "BridgeCreate") {
-    BridgeInfo bi;
-    bi.bridge_id = get("BridgeUniqueid");
-    bi.bridge_type = get("BridgeType");
-    bi.last_update = std::chrono::steady_clock::now();
-    st.bridges[bi.bridge_id] = bi;
-    st.log_line("BridgeCreate: " + bi.bridge_id);
+  const ChannelInfo& c = it->second;
+  mvprintw(2, 0, "Uniqueid %s  Linkedid %s  state %s  dir %s   (last %zu events kept, %zu channels tracked)",
+           c.uniqueid.c_str(), c.linkedid.c_str(), c.state_desc.c_str(), c.dir.c_str(), ChanHistoryPool::kDepth,
+           st.history.live());
+  if (c.history == ChanHistoryPool::kNone) {
+    refresh();
     return;
   }
+  const auto& ring = st.history.slots[c.history];
+  mvprintw(4, 0, "%-10s %-10s %-22s %s", "AGE", "+DELTA", "EVENT", "DETAIL");
+  int y = 5;
+  auto now = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ring.size && y < maxy - 1; i++, y++) {
+    const ChanEvent& e = ring.at(i);
+    auto age = std::chrono::duration_cast<std::chrono::microseconds>(now - e.at).count();
+    auto delta = i ? std::chrono::duration_cast<std::chrono::microseconds>(e.at - ring.at(i - 1).at).count() : 0;
+    std::ostringstream line;
+    line << std::left << std::setw(10) << ("-" + fmt_us(age > 0 ? age : 0)) << " " << std::setw(10)
+         << ("+" + fmt_us(delta > 0 ? delta : 0)) << " " << std::setw(22) << e.type << " " << e.detail;
+    std::string str = line.str();
+    if ((int)str.size() > maxx - 1) str.resize(maxx - 1);
+    mvprintw(y, 0, "%s", str.c_str());
+  }
+  refresh();
+}
 
-  if (event == "BridgeDestroy") {
-    std::string bid = get("BridgeUniqueid");
-    st.bridges.erase(bid);
-    st.log_line("BridgeDestroy: " + bid);
+// Built from the call's raw event log each time it is drawn: one row per event, one lane per
+// channel ('|' while the channel exists, '*' on the channel the event belongs to)
+static void tui_show_timeline(const NodeList& nodes, const UiState& ui) {
+  erase();
+  int maxy, maxx;
+  getmaxyx(stdscr, maxy, maxx);
+
+  mvprintw(0, 0, "Timeline of call %s (press any key to return)   Time: %s", ui.timeline_linkedid.c_str(), now_ts().c_str());
+  mvhline(1, 0, ACS_HLINE, maxx);
+  if (ui.history_node >= (int)nodes.size()) return;
+  const StateStore& st = nodes[ui.history_node]->st;
+  auto it = st.calls.find(ui.timeline_linkedid);
+  if (it == st.calls.end() || it->second.entries.empty()) {
+    mvprintw(2, 0, "No events recorded for this call.");
+    refresh();
     return;
   }
+  const CallLog& log = it->second;
+  const auto t0 = log.entries.front().ev.at;
+  const size_t nch = log.channels.size();
 
-  if (event == "BridgeEnter") {
-    std::string bid = get("BridgeUniqueid");
-    std::string ch = get("Channel");
-    auto& b = st.bridges[bid];
-    b.bridge_id = bid;
-    b.bridge_type = get("BridgeType");
-    b.channels.insert(ch);
-    b.last_update = std::chrono::steady_clock::now();
-    if (b.first_enter == std::chrono::steady_clock::time_point::min()) {
-      b.first_enter = std::chrono::steady_clock::now();
+  // Lifetime of each channel, from its first event to its Hangup
+  std::vector<std::chrono::steady_clock::time_point> born(nch, std::chrono::steady_clock::time_point::max());
+  std::vector<std::chrono::steady_clock::time_point> died(nch, std::chrono::steady_clock::time_point::max());
+  for (const auto& e : log.entries) {
+    born[e.chan] = std::min(born[e.chan], e.ev.at);
+    if (std::strcmp(e.ev.type, "Hangup") == 0) died[e.chan] = e.ev.at;
+  }
+
+  auto rel = [&](std::chrono::steady_clock::time_point t) {
+    std::ostringstream o;
+    o << "+" << std::fixed << std::setprecision(3) << std::chrono::duration<double>(t - t0).count() << "s";
+    return o.str();
+  };
+  int y = 2;
+  std::ostringstream status;
+  status << nch << " channels, " << log.entries.size() << " events";
+  if (log.dropped) status << " (" << log.dropped << " more not kept)";
+  status << (log.live ? ", in progress" : ", ended");
+  mvprintw(y++, 0, "%s", status.str().c_str());
+  for (size_t i = 0; i < nch && y < maxy / 2; i++) {
+    std::ostringstream l;
+    l << "  " << (char)('A' + i % 26) << "  " << std::left << std::setw(40) << log.channels[i].substr(0, 39)
+      << (born[i] == std::chrono::steady_clock::time_point::max() ? "" : rel(born[i]));
+    if (died[i] != std::chrono::steady_clock::time_point::max()) l << " .. " << rel(died[i]);
+    mvprintw(y++, 0, "%s", l.str().c_str());
+  }
+  y++;
+
+  // Newest events when they don't all fit
+  int rows = maxy - 1 - y;
+  size_t from = (int)log.entries.size() > rows ? log.entries.size() - rows : 0;
+  for (size_t k = from; k < log.entries.size() && y < maxy - 1; k++, y++) {
+    const auto& e = log.entries[k];
+    std::string lanes(nch, ' ');
+    for (size_t i = 0; i < nch; i++) {
+      if (i == e.chan) lanes[i] = '*';
+      else if (born[i] <= e.ev.at && e.ev.at <= died[i]) lanes[i] = '|';
     }
-    auto it = st.channels_by_name.find(ch);
-    if (it != st.channels_by_name.end()) it->second.bridge_id = bid;
+    std::ostringstream l;
+    l << std::right << std::setw(10) << rel(e.ev.at) << "  " << lanes << "  " << (char)('A' + e.chan % 26) << "  "
+      << std::left << std::setw(20) << e.ev.type << e.ev.detail;
+    std::string str = l.str();
+    if ((int)str.size() > maxx - 1) str.resize(maxx - 1);
+    mvprintw(y, 0, "%s", str.c_str());
+  }
+  refresh();
+}
+
+static void tui_show_stats(NodeList& nodes, const AppConfig& cfg) {
+  erase();
+  int maxy, maxx;
+  getmaxyx(stdscr, maxy, maxx);
+
+  mvprintw(0, 0, "Stats (press any key to return)   Time: %s", now_ts().c_str());
+  mvhline(1, 0, ACS_HLINE, maxx);
+
+  int y = 2;
+  if (cfg.action_rate > 0) {
+    mvprintw(y++, 0, "Action rate limit: %.0f/s per node, burst %.0f", cfg.action_rate, cfg.action_burst);
+  } else {
+    mvprintw(y++, 0, "Action rate limit: off (ACTION_RATE=0)");
+  }
+  y++;
+  for (auto& n : nodes) {
+    if (y >= maxy - 1) break;
+    AmiClient& a = n->ami;
+    std::ostringstream oss;
+    oss << std::left << std::setw(14) << n->st.node.substr(0, 14) << std::right
+        << (a.connected() ? " up  " : " DOWN")
+        << "  msgs " << a.messages_read()
+        << "  actions: sent " << a.actions_sent()
+        << "  in-flight " << a.actions_in_flight()
+        << "  rate-limited " << a.actions_limited()
+        << "  rejected " << a.actions_rejected()
+        << "  coalesced " << a.actions_coalesced();
+    if (n->st.heartbeat.pings) {
+      oss << "  pings " << n->st.heartbeat.pings << " lost " << n->st.heartbeat.lost << " reconnects " << a.reconnects();
+    }
+    if (a.seq_gaps() || a.queue_dropped() || n->st.resync.runs) {
+      oss << "  lost: gaps " << a.seq_gaps() << " (" << a.seq_missing() << " events) dropped " << a.queue_dropped()
+          << "  resyncs " << n->st.resync.runs << " +" << n->st.resync.added << "/-" << n->st.resync.removed;
+    }
+    if (n->st.stamped_events) {
+      LatencyHistogram lag = n->st.event_lag.merged();
+      oss << "  event lag now " << (n->st.last_lag_us < 0 ? "-" : "") << fmt_us(std::abs(n->st.last_lag_us))
+          << " p50 " << fmt_us(lag.percentile_us(50)) << " p99 " << fmt_us(lag.percentile_us(99));
+    } else {
+      oss << "  event lag n/a (no Timestamp headers)";
+    }
+    std::string s = oss.str();
+    if ((int)s.size() > maxx - 1) s.resize(maxx - 1);
+    mvprintw(y++, 0, "%s", s.c_str());
+
+    // Heap allocations per event on the event path (diagnostic builds), and the batch arena behind it
+    if (y < maxy - 1) {
+      std::ostringstream ms;
+      std::lock_guard<std::mutex> lk(n->q_mu);
+#ifdef CALLMON_COUNT_ALLOCS
+      auto now = std::chrono::steady_clock::now();
+      ms << "  heap allocs/event (1 min): read " << std::fixed << std::setprecision(1)
+         << n->batch.parse_allocs_per_event(now) << "  apply " << n->batch.apply_allocs_per_event(now) << "  ";
+#endif
+      ms << "  batch arena " << n->batch.arena_bytes() / 1024 << " KiB, grown " << n->batch.arena_grows() << "x";
+      mvprintw(y++, 0, "%s", ms.str().c_str());
+    }
+
+    // Action latency per type: write -> Response, and write -> the event showing the effect
+    for (const auto& [action, l] : a.action_latency()) {
+      if (y >= maxy - 1) break;
+      std::ostringstream ls;
+      ls << "  " << std::left << std::setw(16) << action.substr(0, 15) << std::right << std::setw(7) << l.response.count
+         << " resp p50 " << std::setw(7) << fmt_us(l.response.percentile_us(50)) << " p99 " << std::setw(7)
+         << fmt_us(l.response.percentile_us(99));
+      if (l.effect.count || l.no_effect) {
+        ls << "   effect " << std::setw(6) << l.effect.count << " p50 " << std::setw(7)
+           << fmt_us(l.effect.percentile_us(50)) << " p99 " << std::setw(7) << fmt_us(l.effect.percentile_us(99))
+           << "  not seen " << l.no_effect;
+      }
+      s = ls.str();
+      if ((int)s.size() > maxx - 1) s.resize(maxx - 1);
+      mvprintw(y++, 0, "%s", s.c_str());
+    }
+
+    // Transcoded calls, counted against each trunk peer in them
+    if (cfg.codec_detect && y < maxy - 1) {
+      int xcode = 0;
+      std::map<std::string, int> by_trunk;
+      for (const auto& [bid, b] : n->st.bridges) {
+        std::set<std::string> codecs;
+        if (b.channels.empty() || !bridge_transcodes(n->st, b, codecs)) continue;
+        xcode++;
+        for (const auto& ch : b.channels) {
+          auto cit = n->st.channels_by_name.find(ch);
+          if (cit != n->st.channels_by_name.end() && cit->second.is_trunk) by_trunk[cit->second.peer]++;
+        }
+      }
+      std::ostringstream xs;
+      xs << "  Transcoded calls " << xcode << "  (formats pending " << n->st.fmt_wanted.size() + n->st.fmt_inflight.size() / 3 << ")";
+      for (const auto& [peer, cnt] : by_trunk) xs << "  " << peer << " " << cnt;
+      s = xs.str();
+      if ((int)s.size() > maxx - 1) s.resize(maxx - 1);
+      mvprintw(y++, 0, "%s", s.c_str());
+    }
+
+    // QA sampling per stratum: answered / sampled / skipped for lack of a free supervisor
+    if (n->st.qa_strata.empty()) continue;
+    std::ostringstream qa;
+    qa << "  QA active " << n->st.qa_active << "  ";
+    for (const auto& [stratum, c] : n->st.qa_strata) {
+      qa << stratum << " " << c.answered << "/" << c.sampled << "/" << c.skipped << "  ";
+    }
+    s = qa.str();
+    if ((int)s.size() > maxx - 1) s.resize(maxx - 1);
+    if (y < maxy - 1) mvprintw(y++, 0, "%s", s.c_str());
+  }
+  refresh();
+}
+
+// Slowest dialplan steps across nodes, by p95 step time
+static void tui_show_profile(const NodeList& nodes, const AppConfig& cfg) {
+  erase();
+  int maxy, maxx;
+  getmaxyx(stdscr, maxy, maxx);
+
+  mvprintw(0, 0, "Dialplan profile, slowest steps by p95 (press any key to return)   Time: %s", now_ts().c_str());
+  mvhline(1, 0, ACS_HLINE, maxx);
+  if (!cfg.dialplan_profile) {
+    mvprintw(2, 0, "Profiler is off. Set DIALPLAN_PROFILE=yes and reload (AMI user needs read=dialplan).");
+    refresh();
     return;
   }
 
-  if (event == "BridgeLeave") {
-    std::string bid = get("BridgeUniqueid");
-    std::string ch = get("Channel");
-    auto bit = st.bridges.find(bid);
-    if (bit != st.bridges.end()) {
-      bit->second.channels.erase(ch);
-      bit->second.last_update = std::chrono::steady_clock::now();
+  struct Row {
+    const std::string* node;
+    const DialplanStep* step;
+  };
+  std::vector<Row> rows;
+  uint64_t dropped = 0;
+  for (const auto& n : nodes) {
+    for (const auto& [key, d] : n->st.dialplan_steps) {
+      if (d.hist.count) rows.push_back({&n->st.node, &d});
     }
-    auto it = st.channels_by_name.find(ch);
-    if (it != st.channels_by_name.end()) it->second.bridge_id.clear();
+    dropped += n->st.dialplan_steps_dropped;
+  }
+  std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+    uint64_t pa = a.step->hist.percentile_us(95), pb = b.step->hist.percentile_us(95);
+    if (pa != pb) return pa > pb;
+    return a.step->hist.sum_us > b.step->hist.sum_us;
+  });
+
+  bool multi = nodes.size() > 1;
+  std::ostringstream hdr;
+  if (multi) hdr << std::left << std::setw(11) << "NODE";
+  hdr << std::left << std::setw(24) << "CONTEXT" << std::setw(16) << "EXTEN" << std::setw(5) << "PRI"
+      << std::setw(14) << "APP" << std::right << std::setw(8) << "COUNT" << std::setw(10) << "MEAN"
+      << std::setw(10) << "P95" << std::setw(10) << "MAX" << std::setw(10) << "TOTAL";
+  mvprintw(2, 0, "%s", hdr.str().c_str());
+  if (dropped) printw("   (%llu steps over the %zu-step limit not timed)", (unsigned long long)dropped, kMaxDialplanSteps);
+
+  int y = 3;
+  for (const auto& r : rows) {
+    if (y >= maxy - 1) break;
+    const DialplanStep& d = *r.step;
+    std::ostringstream line;
+    if (multi) line << std::left << std::setw(11) << r.node->substr(0, 10);
+    line << std::left << std::setw(24) << d.context.substr(0, 23) << std::setw(16) << d.exten.substr(0, 15)
+         << std::setw(5) << d.priority.substr(0, 4) << std::setw(14) << d.app.substr(0, 13) << std::right
+         << std::setw(8) << d.hist.count << std::setw(10) << fmt_us(d.hist.mean_us())
+         << std::setw(10) << fmt_us(d.hist.percentile_us(95)) << std::setw(10) << fmt_us(d.hist.max_us)
+         << std::setw(10) << fmt_us(d.hist.sum_us);
+    std::string s = line.str();
+    if ((int)s.size() > maxx - 1) s.resize(maxx - 1);
+    mvprintw(y++, 0, "%s", s.c_str());
+  }
+  refresh();
+}
+
+// PJSIP endpoints across nodes, sorted by p95 RTT, recent flaps or name
+static void tui_show_endpoints(const NodeList& nodes, const UiState& ui) {
+  erase();
+  int maxy, maxx;
+  getmaxyx(stdscr, maxy, maxx);
+
+  mvprintw(0, 0, "PJSIP endpoints, sort: %s ([O]=Sort, any other key returns)   Time: %s", ui.endpoint_sort.c_str(),
+           now_ts().c_str());
+  mvhline(1, 0, ACS_HLINE, maxx);
+
+  struct Row {
+    const std::string* node;
+    const std::string* name;
+    const EndpointHealth* e;
+    LatencyHistogram h;
+    int flaps;
+  };
+  std::vector<Row> rows;
+  for (const auto& n : nodes) {
+    for (const auto& [name, e] : n->st.endpoints) {
+      rows.push_back({&n->st.node, &name, &e, e.rtt.merged(), e.flaps_within(std::chrono::hours(1))});
+    }
+  }
+  std::sort(rows.begin(), rows.end(), [&](const Row& a, const Row& b) {
+    if (ui.endpoint_sort == "flaps" && a.flaps != b.flaps) return a.flaps > b.flaps;
+    if (ui.endpoint_sort == "rtt") {
+      uint64_t pa = a.h.percentile_us(95), pb = b.h.percentile_us(95);
+      if (pa != pb) return pa > pb;
+    }
+    return *a.name < *b.name;
+  });
+
+  bool multi = nodes.size() > 1;
+  std::ostringstream hdr;
+  if (multi) hdr << std::left << std::setw(11) << "NODE";
+  hdr << std::left << std::setw(24) << "ENDPOINT" << std::setw(13) << "STATUS" << std::right << std::setw(9)
+      << "CONTACTS" << std::setw(10) << "LAST" << std::setw(10) << "P50" << std::setw(10) << "P95" << std::setw(10)
+      << "MAX" << std::setw(9) << "SAMPLES" << std::setw(10) << "FLAPS/1H";
+  mvprintw(2, 0, "%s", hdr.str().c_str());
+
+  int y = 3;
+  for (const auto& r : rows) {
+    if (y >= maxy - 1) break;
+    std::ostringstream line;
+    if (multi) line << std::left << std::setw(11) << r.node->substr(0, 10);
+    line << std::left << std::setw(24) << r.name->substr(0, 23) << std::setw(13) << r.e->status << std::right
+         << std::setw(9) << r.e->contacts.size() << std::setw(10) << (r.e->last_rtt_us ? fmt_us(r.e->last_rtt_us) : "-")
+         << std::setw(10) << (r.h.count ? fmt_us(r.h.percentile_us(50)) : "-")
+         << std::setw(10) << (r.h.count ? fmt_us(r.h.percentile_us(95)) : "-")
+         << std::setw(10) << (r.h.count ? fmt_us(r.h.max_us) : "-") << std::setw(9) << r.h.count << std::setw(10)
+         << r.flaps;
+    std::string str = line.str();
+    if ((int)str.size() > maxx - 1) str.resize(maxx - 1);
+    bool bad = r.e->status == "unreachable";
+    if (bad) attron(A_BOLD);
+    mvprintw(y++, 0, "%s", str.c_str());
+    if (bad) attroff(A_BOLD);
+  }
+  refresh();
+}
+
+// Device/extension states across nodes as a grid, unavailable first, then by extension or name
+static void tui_show_devices(const NodeList& nodes) {
+  erase();
+  int maxy, maxx;
+  getmaxyx(stdscr, maxy, maxx);
+
+  mvprintw(0, 0, "Devices and extensions (press any key to return)   Time: %s", now_ts().c_str());
+  mvhline(1, 0, ACS_HLINE, maxx);
+
+  struct Cell {
+    const DeviceIndex* idx;
+    uint32_t id;
+    const StateStore* st;
+  };
+  std::vector<Cell> cells;
+  std::array<int, (int)DevState::Count> totals{};
+  uint64_t events = 0, updates = 0;
+  for (const auto& n : nodes) {
+    const DeviceIndex& d = n->st.devices;
+    for (uint32_t id = 0; id < d.names.size(); id++) cells.push_back({&d, id, &n->st});
+    for (int i = 0; i < (int)DevState::Count; i++) totals[i] += d.totals[i];
+    events += d.events;
+    updates += d.updates;
+  }
+  auto rank = [](DevState s) {
+    switch (s) {
+      case DevState::Unavailable: case DevState::Invalid: return 0;
+      case DevState::Ringing: return 1;
+      case DevState::InUse: case DevState::Busy: case DevState::OnHold: return 2;
+      case DevState::Idle: return 3;
+      default: return 4;
+    }
+  };
+  std::sort(cells.begin(), cells.end(), [&](const Cell& a, const Cell& b) {
+    const auto& sa = a.idx->slots[a.id];
+    const auto& sb = b.idx->slots[b.id];
+    if (rank(sa.state) != rank(sb.state)) return rank(sa.state) < rank(sb.state);
+    const std::string& ka = sa.exten.empty() ? a.idx->names[a.id] : sa.exten;
+    const std::string& kb = sb.exten.empty() ? b.idx->names[b.id] : sb.exten;
+    return ka < kb;
+  });
+
+  std::ostringstream sum;
+  for (int i = 1; i <= (int)DevState::Count; i++) {
+    int s = i % (int)DevState::Count; // Unknown last
+    if (totals[s]) sum << dev_state_name((DevState)s) << " " << totals[s] << "  ";
+  }
+  sum << "  events " << events << " -> updates " << updates;
+  std::string sl = sum.str();
+  if ((int)sl.size() > maxx - 1) sl.resize(maxx - 1);
+  mvprintw(2, 0, "%s", sl.c_str());
+
+  // Registration comes from the PJSIP endpoint index (contacts known, and reachability)
+  auto reg = [](const StateStore& st, const std::string& dev) -> std::string {
+    if (dev.rfind("PJSIP/", 0) != 0) return "";
+    auto it = st.endpoints.find(dev.substr(6));
+    if (it == st.endpoints.end()) return "";
+    if (it->second.contacts.empty()) return " unreg";
+    return it->second.status == "unreachable" ? " unreach" : "";
+  };
+
+  const int w = 44;
+  int per_row = std::max(1, maxx / w);
+  int y = 4, col = 0;
+  for (const auto& c : cells) {
+    if (y >= maxy - 1) break;
+    const auto& sl2 = c.idx->slots[c.id];
+    std::ostringstream cell;
+    cell << std::left << std::setw(8) << (sl2.exten.empty() ? "" : sl2.exten.substr(0, 7))
+         << std::setw(18) << c.idx->names[c.id].substr(0, 17) << std::setw(12) << dev_state_name(sl2.state)
+         << secs_since(sl2.since) << "s" << reg(*c.st, c.idx->names[c.id]);
+    std::string str = cell.str();
+    if ((int)str.size() > w - 1) str.resize(w - 1);
+    bool bad = rank(sl2.state) == 0;
+    if (bad) attron(A_BOLD);
+    mvprintw(y, col * w, "%s", str.c_str());
+    if (bad) attroff(A_BOLD);
+    if (++col >= per_row) {
+      col = 0;
+      y++;
+    }
+  }
+  refresh();
+}
+
+static std::string sparkline(const Ring<uint32_t, 60>& r, size_t width) {
+  static const char kLevels[] = " .:-=+*#%@";
+  size_t from = r.size > width ? r.size - width : 0;
+  uint32_t peak = 1;
+  for (size_t i = from; i < r.size; i++) peak = std::max(peak, r.at(i));
+  std::string out;
+  for (size_t i = from; i < r.size; i++) out += kLevels[(size_t)r.at(i) * 9 / peak];
+  return out;
+}
+
+// Taskprocessor queues across nodes, alerting and deepest first
+static void tui_show_taskprocs(const NodeList& nodes, const AppConfig& cfg) {
+  erase();
+  int maxy, maxx;
+  getmaxyx(stdscr, maxy, maxx);
+
+  mvprintw(0, 0, "Taskprocessors (press any key to return)   Time: %s", now_ts().c_str());
+  mvhline(1, 0, ACS_HLINE, maxx);
+  if (cfg.taskproc_sample_sec <= 0) {
+    mvprintw(2, 0, "Sampling is off. Set TASKPROC_SAMPLE_SEC (e.g. 10) and reload (AMI user needs write=command).");
+    refresh();
     return;
   }
 
-  // Optional: DialBegin/DialEnd could be used to refine direction and ring time if desired.
+  struct Row {
+    const std::string* node;
+    const std::string* name;
+    const TaskprocSeries* s;
+  };
+  std::vector<Row> rows;
+  std::ostringstream sum;
+  sum << "Every " << cfg.taskproc_sample_sec << "s, alert at depth " << cfg.taskproc_alert_depth << " or 3 rising samples.";
+  for (const auto& n : nodes) {
+    const TaskprocSampler& tp = n->st.taskprocs;
+    sum << "  " << n->st.node << ": " << tp.samples << " samples";
+    if (tp.failures) sum << ", " << tp.failures << " failed";
+    for (const auto& [name, s] : tp.series) rows.push_back({&n->st.node, &name, &s});
+  }
+  std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+    if (a.s->alert != b.s->alert) return a.s->alert;
+    if (a.s->depth.back() != b.s->depth.back()) return a.s->depth.back() > b.s->depth.back();
+    return a.s->max_depth > b.s->max_depth;
+  });
+  std::string sl = sum.str();
+  if ((int)sl.size() > maxx - 1) sl.resize(maxx - 1);
+  mvprintw(2, 0, "%s", sl.c_str());
+
+  bool multi = nodes.size() > 1;
+  std::ostringstream hdr;
+  if (multi) hdr << std::left << std::setw(11) << "NODE";
+  hdr << std::left << std::setw(44) << "TASKPROCESSOR" << std::right << std::setw(7) << "DEPTH" << std::setw(7)
+      << "PEAK" << std::setw(9) << "MAXDEPTH" << std::setw(10) << "TASKS/S" << "  HISTORY (newest right)";
+  mvprintw(3, 0, "%s", hdr.str().c_str());
+
+  int y = 4;
+  for (const auto& r : rows) {
+    if (y >= maxy - 1) break;
+    const TaskprocSeries& s = *r.s;
+    uint32_t peak = 0;
+    for (size_t i = 0; i < s.depth.size; i++) peak = std::max(peak, s.depth.at(i));
+    std::ostringstream line;
+    if (multi) line << std::left << std::setw(11) << r.node->substr(0, 10);
+    line << std::left << std::setw(44) << r.name->substr(0, 43) << std::right << std::setw(7) << s.depth.back()
+         << std::setw(7) << peak << std::setw(9) << s.max_depth << std::setw(10) << std::fixed
+         << std::setprecision(1) << s.rate << "  " << std::left << std::setw(30) << sparkline(s.depth, 30)
+         << (s.alert ? "  ALERT" : "");
+    std::string str = line.str();
+    if ((int)str.size() > maxx - 1) str.resize(maxx - 1);
+    if (s.alert) attron(A_BOLD);
+    mvprintw(y++, 0, "%s", str.c_str());
+    if (s.alert) attroff(A_BOLD);
+  }
+  refresh();
 }
 
-// --- TUI ---
-struct BridgeRow {
-  std::string bridge_id;
-  std::string dir;
-  int duration_sec = 0;
-  int participants = 0;
-  std::vector<std::string> member_channels;
-  std::string summary;
-};
+static void tui_show_causes(NodeList& nodes, const AppConfig& cfg) {
+  erase();
+  int maxy, maxx;
+  getmaxyx(stdscr, maxy, maxx);
+  auto now = std::chrono::steady_clock::now();
 
-static std::vector<BridgeRow> build_bridge_rows(StateStore& st, const AppConfig& cfg) {
-  std::vector<BridgeRow> rows;
-  rows.reserve(st.bridges.size());
+  mvprintw(0, 0, "Hangup causes on trunk legs (press any key to return)   Time: %s", now_ts().c_str());
+  mvhline(1, 0, ACS_HLINE, maxx);
+  mvprintw(2, 0, "Failure causes (3,21,27,34,38,41,42,44,47,102) spike at %d/min and 3x the previous 14 min rate.",
+           cfg.cause_spike_min);
 
-  for (const auto& [bid, b] : st.bridges) {
-    if (b.channels.empty()) continue;
+  struct Row {
+    const std::string* node;
+    TrunkCauses* tc;
+    int cause;
+    CauseCounter* cc;
+    bool spike;
+    uint64_t m15;
+  };
+  std::vector<Row> rows;
+  for (auto& n : nodes) {
+    for (auto& [key, tc] : n->st.hangup_causes) {
+      for (auto& [cause, cc] : tc.causes) {
+        bool spike = is_failure_cause(cause) && cause_spiking(cc, cfg, now);
+        rows.push_back({&n->st.node, &tc, cause, &cc, spike, cc.last15m.sum(now)});
+      }
+    }
+  }
+  std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+    if (a.spike != b.spike) return a.spike;
+    if (a.m15 != b.m15) return a.m15 > b.m15;
+    return a.cc->total > b.cc->total;
+  });
 
-    BridgeRow r;
-    r.bridge_id = bid;
-    r.duration_sec = secs_since(b.first_enter);
-    r.participants = (int)b.channels.size();
-    r.member_channels.assign(b.channels.begin(), b.channels.end());
+  bool multi = nodes.size() > 1;
+  std::ostringstream hdr;
+  if (multi) hdr << std::left << std::setw(11) << "NODE";
+  hdr << std::left << std::setw(22) << "TRUNK" << std::setw(10) << "DIR" << std::right << std::setw(6) << "CAUSE"
+      << "  " << std::left << std::setw(28) << "TEXT" << std::right << std::setw(6) << "1m" << std::setw(6) << "15m"
+      << std::setw(7) << "SHARE" << std::setw(6) << "1h" << std::setw(8) << "TOTAL";
+  mvprintw(4, 0, "%s", hdr.str().c_str());
 
-    // Determine direction by looking at member channels classifications
-    std::map<std::string, int> counts;
-    for (const auto& ch : r.member_channels) {
-      auto it = st.channels_by_name.find(ch);
-      if (it == st.channels_by_name.end()) continue;
-      std::string d = classify_dir_heuristic(it->second, cfg);
-      counts[d]++;
+  int y = 5;
+  for (const auto& r : rows) {
+    if (y >= maxy - 1) break;
+    uint64_t calls = r.tc->calls15m.sum(now);
+    std::ostringstream line;
+    if (multi) line << std::left << std::setw(11) << r.node->substr(0, 10);
+    line << std::left << std::setw(22) << r.tc->trunk.substr(0, 21) << std::setw(10) << r.tc->dir << std::right
+         << std::setw(6) << r.cause << "  " << std::left << std::setw(28) << r.cc->text.substr(0, 27) << std::right
+         << std::setw(6) << r.cc->last1m.sum(now) << std::setw(6) << r.m15 << std::setw(6)
+         << (calls ? r.m15 * 100 / calls : 0) << "%" << std::setw(6) << r.cc->last1h.sum(now) << std::setw(8)
+         << r.cc->total << (r.spike ? "  SPIKE" : "");
+    std::string str = line.str();
+    if ((int)str.size() > maxx - 1) str.resize(maxx - 1);
+    if (r.spike) attron(A_BOLD | A_REVERSE);
+    else if (is_failure_cause(r.cause) && r.m15) attron(A_BOLD);
+    mvprintw(y++, 0, "%s", str.c_str());
+    attroff(A_BOLD | A_REVERSE);
+  }
+  if (rows.empty()) mvprintw(5, 0, "No trunk hangups yet (trunk legs are matched with TRUNK_PREFIXES).");
+  refresh();
+}
+
+static void signal_handler(int) {
+  g_running.store(false);
+}
+
+static void sighup_handler(int) {
+  g_reload.store(true);
+}
+
+static std::vector<std::string> split_list(const std::string& s) {
+  std::vector<std::string> out;
+  std::istringstream is(s);
+  std::string item;
+  while (std::getline(is, item, ',')) {
+    item = trim(item);
+    if (!item.empty()) out.push_back(item);
+  }
+  return out;
+}
+
+static bool parse_bool(const std::string& v) {
+  std::string l = lower(v);
+  return l == "1" || l == "yes" || l == "true" || l == "on";
+}
+
+// "pbx1@10.0.0.1:5038,pbx2@10.0.0.2" -> nodes. Name defaults to the host, port to 5038.
+static std::vector<AmiNodeConfig> parse_nodes(const std::string& s) {
+  std::vector<AmiNodeConfig> out;
+  for (const auto& item : split_list(s)) {
+    AmiNodeConfig n;
+    std::string addr = item;
+    auto at = item.find('@');
+    if (at != std::string::npos) {
+      n.name = item.substr(0, at);
+      addr = item.substr(at + 1);
     }
-    std::string dir = "unknown";
-    int best = 0;
-    for (auto& kv : counts) {
-      if (kv.second > best) { best = kv.second; dir = kv.first; }
+    auto colon = addr.rfind(':');
+    if (colon != std::string::npos) {
+      n.port = std::stoi(addr.substr(colon + 1));
+      addr = addr.substr(0, colon);
     }
-    r.dir = dir;
+    n.host = addr;
+    if (n.name.empty()) n.name = n.host;
+    out.push_back(n);
+  }
+  return out;
+}
 
-    // Apply filter
-    if (lower(st.filter) != "all" && lower(st.filter) != lower(r.dir)) continue;
+// "queue:sales=25,PJSIP/provider=10" -> stratum -> percent
+static std::map<std::string, double> parse_strata(const std::string& s) {
+  std::map<std::string, double> out;
+  for (const auto& item : split_list(s)) {
+    auto eq = item.rfind('=');
+    if (eq == std::string::npos) throw std::runtime_error("QA_SAMPLE_STRATA: expected stratum=percent, got " + item);
+    out[trim(item.substr(0, eq))] = std::stod(item.substr(eq + 1));
+  }
+  return out;
+}
 
-    // Build human summary: try to pick 1-2 legs with caller->connected
-    std::ostringstream sum;
-    int shown = 0;
-    for (const auto& ch : r.member_channels) {
-      auto it = st.channels_by_name.find(ch);
-      if (it == st.channels_by_name.end()) continue;
-      const auto& c = it->second;
+// Single mapping from config keys to AppConfig fields, shared by env and config file.
+// Returns false for unknown keys. Throws on malformed numbers.
+static bool apply_config_value(AppConfig& cfg, const std::string& k, const std::string& v) {
+  if (k == "AMI_HOST") cfg.ami_host = v;
+  else if (k == "AMI_PORT") cfg.ami_port = std::stoi(v);
+  else if (k == "AMI_USER") cfg.ami_user = v;
+  else if (k == "AMI_SECRET") cfg.ami_secret = v;
+  else if (k == "AMI_NODES") cfg.nodes = parse_nodes(v);
+  else if (k == "AMI_ACTION_CONN") cfg.ami_action_conn = parse_bool(v);
+  else if (k == "ACTION_TIMEOUT_MS") cfg.action_timeout_ms = std::stoi(v);
+  else if (k == "BULK_WINDOW") cfg.bulk_window = std::stoi(v);
+  else if (k == "ACTION_RATE") cfg.action_rate = std::stod(v);
+  else if (k == "ACTION_BURST") cfg.action_burst = std::stod(v);
+  else if (k == "SUPERVISOR_ENDPOINT") cfg.supervisor_endpoint = v;
+  else if (k == "SUPERVISOR_CONTEXT") cfg.supervisor_context = v;
+  else if (k == "SUPERVISOR_PREFIX") cfg.supervisor_prefix = v;
+  else if (k == "ORIGINATE_TIMEOUT_MS") cfg.originate_timeout_ms = std::stoi(v);
+  else if (k == "TRUNK_PREFIXES") cfg.trunk_prefixes = split_list(v);
+  else if (k == "QUARANTINE_TRUNKS") cfg.quarantine_trunks = split_list(v);
+  else if (k == "QA_SAMPLE_PERCENT") cfg.qa_sample_percent = std::stod(v);
+  else if (k == "QA_SAMPLE_STRATA") cfg.qa_strata_percent = parse_strata(v);
+  else if (k == "QA_SUPERVISORS") cfg.qa_supervisors = split_list(v);
+  else if (k == "QA_MAX_CONCURRENT") cfg.qa_max_concurrent = std::stoi(v);
+  else if (k == "DIALPLAN_PROFILE") cfg.dialplan_profile = parse_bool(v);
+  else if (k == "CODEC_DETECT") cfg.codec_detect = parse_bool(v);
+  else if (k == "QUEUE_SL_SEC") cfg.queue_sl_sec = std::stoi(v);
+  else if (k == "TASKPROC_SAMPLE_SEC") cfg.taskproc_sample_sec = std::stoi(v);
+  else if (k == "TASKPROC_ALERT_DEPTH") cfg.taskproc_alert_depth = std::stoi(v);
+  else if (k == "CAUSE_SPIKE_MIN") cfg.cause_spike_min = std::stoi(v);
+  else if (k == "SEQ_GAP_RESYNC") cfg.seq_gap_resync = parse_bool(v);
+  else if (k == "PING_INTERVAL_SEC") cfg.ping_interval_sec = std::stoi(v);
+  else if (k == "PING_MISSES") cfg.ping_misses = std::max(1, std::stoi(v));
+  else if (k == "RESYNC_MIN_SEC") cfg.resync_min_sec = std::stoi(v);
+  else if (k == "RECORDING_DIR") cfg.recording_dir = v;
+  else if (k == "RECORDING_FORMAT") cfg.recording_format = v;
+  else if (k == "RECORDING_OPTIONS") cfg.recording_options = v;
+  else return false;
+  return true;
+}
+
+static const char* const kConfigKeys[] = {
+  "AMI_HOST", "AMI_PORT", "AMI_USER", "AMI_SECRET", "AMI_NODES", "AMI_ACTION_CONN", "ACTION_TIMEOUT_MS",
+  "BULK_WINDOW", "ACTION_RATE", "ACTION_BURST",
+  "SUPERVISOR_ENDPOINT", "SUPERVISOR_CONTEXT", "SUPERVISOR_PREFIX", "ORIGINATE_TIMEOUT_MS",
+  "TRUNK_PREFIXES", "QUARANTINE_TRUNKS",
+  "QA_SAMPLE_PERCENT", "QA_SAMPLE_STRATA", "QA_SUPERVISORS", "QA_MAX_CONCURRENT",
+  "DIALPLAN_PROFILE", "CODEC_DETECT", "QUEUE_SL_SEC", "TASKPROC_SAMPLE_SEC", "TASKPROC_ALERT_DEPTH", "CAUSE_SPIKE_MIN", "SEQ_GAP_RESYNC", "RESYNC_MIN_SEC", "PING_INTERVAL_SEC", "PING_MISSES", "RECORDING_DIR", "RECORDING_FORMAT", "RECORDING_OPTIONS",
+};
+
+// Lists and free text can be cleared with KEY= ; for other keys an empty value means the default
+static bool config_value_may_be_empty(const std::string& k) {
+  static const std::set<std::string> kKeys = {"AMI_NODES", "TRUNK_PREFIXES", "QUARANTINE_TRUNKS",
+                                              "QA_SAMPLE_STRATA", "QA_SUPERVISORS", "SUPERVISOR_ENDPOINT",
+                                              "RECORDING_DIR", "RECORDING_OPTIONS"};
+  return kKeys.count(k) > 0;
+}
+
+using ConfigPairs = std::vector<std::pair<std::string, std::string>>;
+
+// KEY=VALUE lines from path, in file order. Returns false if the file cannot be opened.
+static bool read_config_file(const std::string& path, ConfigPairs& out) {
+  std::ifstream in(path);
+  if (!in) return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    line = trim(line);
+    if (line.empty() || line[0] == '#') continue;
+    auto eq = line.find('=');
+    if (eq == std::string::npos) continue;
+    std::string k = trim(line.substr(0, eq));
+    std::string v = trim(line.substr(eq + 1));
+    if (v.size() >= 2 && (v.front() == '"' || v.front() == '\'') && v.back() == v.front()) {
+      v = v.substr(1, v.size() - 2);
+    }
+    out.emplace_back(std::move(k), std::move(v));
+  }
+  return true;
+}
+
+static void apply_config_pairs(AppConfig& cfg, const ConfigPairs& pairs) {
+  for (const auto& [k, v] : pairs) {
+    if (!v.empty() || config_value_may_be_empty(k)) apply_config_value(cfg, k, v);
+  }
+}
+
+// Build a snapshot from scratch: defaults, then the file, then environment overrides, then the
+// command line. Starting from defaults lets a key removed from the file fall back on reload.
+// cfg carries config_file and the overrides. Returns false if the file cannot be opened.
+static bool compose_config(AppConfig& cfg) {
+  ConfigPairs file;
+  bool ok = read_config_file(cfg.config_file, file);
+  apply_config_pairs(cfg, file);
+  apply_config_pairs(cfg, cfg.env_overrides);
+  apply_config_pairs(cfg, cfg.cli_overrides);
+  return ok;
+}
+
+static AppConfig read_config_from_env_and_args(int argc, char** argv) {
+  AppConfig cfg;
+
+  const char* path = std::getenv("CALLMON_CONFIG");
+  if (path && *path) cfg.config_file = path;
+
+  // systemd's EnvironmentFile is usually the config file itself, so an environment value equal to
+  // the file's is not an override; otherwise it would pin the startup value across reloads.
+  ConfigPairs file;
+  read_config_file(cfg.config_file, file);
+  for (const char* k : kConfigKeys) {
+    const char* v = std::getenv(k);
+    if (!v || (!*v && !config_value_may_be_empty(k))) continue;
+    auto fit = std::find_if(file.rbegin(), file.rend(), [&](const auto& p) { return p.first == k; });
+    if (fit != file.rend() && fit->second == v) continue;
+    cfg.env_overrides.emplace_back(k, v);
+  }
+
+  // CLI: host port user secret
+  if (argc >= 3) {
+    cfg.cli_overrides.emplace_back("AMI_HOST", argv[1]);
+    cfg.cli_overrides.emplace_back("AMI_PORT", argv[2]);
+  }
+  if (argc >= 4) cfg.cli_overrides.emplace_back("AMI_USER", argv[3]);
+  if (argc >= 5) cfg.cli_overrides.emplace_back("AMI_SECRET", argv[4]);
 
-      std::string caller = c.caller_num.empty() ? "unknown" : c.caller_num;
-      std::string conn = c.connected_num.empty() ? "unknown" : c.connected_num;
-      if (caller == "unknown" && conn == "unknown") continue;
+  compose_config(cfg);
+  return cfg;
+}
 
-      sum << c.tech << "/" << c.peer << " " << caller << "->" << conn << "  ";
-      if (++shown >= 2) break;
+// Re-read the config file into a fresh snapshot and publish it. Runs on the UI thread between
+// queue drains, so the reader thread keeps ingesting events throughout. Connection settings are
+// pinned to the running session; only a restart applies them.
+static void reload_config(ConfigStore& conf, NodeList& nodes, AuditLog& log) {
+  auto cur = conf.get();
+  AppConfig next;
+  next.config_file = cur->config_file;
+  next.env_overrides = cur->env_overrides;
+  next.cli_overrides = cur->cli_overrides;
+  try {
+    if (!compose_config(next)) {
+      log.add("Config reload: cannot read " + cur->config_file + ", keeping current config");
+      return;
     }
-    r.summary = sum.str();
-    rows.push_back(std::move(r));
+  } catch (const std::exception& ex) {
+    log.add("Config reload: invalid value in " + cur->config_file + " (" + ex.what() + "), keeping current config");
+    return;
   }
 
-  // Stable ordering: longest duration first (more relevant)
-  std::sort(rows.begin(), rows.end(), [](const BridgeRow& a, const BridgeRow& b) {
-    return a.duration_sec > b.duration_sec;
-  });
+  if (next.ami_host != cur->ami_host || next.ami_port != cur->ami_port ||
+      next.ami_user != cur->ami_user || next.ami_secret != cur->ami_secret || next.nodes != cur->nodes ||
+      next.ami_action_conn != cur->ami_action_conn) {
+    log.add("Config reload: AMI connection settings changed, restart to apply");
+    next.ami_host = cur->ami_host;
+    next.ami_port = cur->ami_port;
+    next.ami_user = cur->ami_user;
+    next.ami_secret = cur->ami_secret;
+    next.nodes = cur->nodes;
+    next.ami_action_conn = cur->ami_action_conn;
+  }
 
-  return rows;
-}
+  // Only channels whose trunk match flips need their direction recomputed
+  int reclassified = 0;
+  if (next.trunk_prefixes != cur->trunk_prefixes) {
+    for (auto& n : nodes) {
+      for (auto& [name, c] : n->st.channels_by_name) {
+        if (matches_trunk_prefix(c.channel, next) == c.is_trunk) continue;
+        classify_channel(c, next);
+        reclassified++;
+      }
+    }
+  }
 
-static void tui_draw(StateStore& st, const AppConfig& cfg) {
-  erase();
-  int maxy, maxx;
-  getmaxyx(stdscr, maxy, maxx);
+  conf.publish(std::move(next));
+  log.add("Config reloaded from " + cur->config_file + " (" + std::to_string(reclassified) + " channels reclassified)");
+}
 
-  mvprintw(0, 0, "Asterisk AMI Call Monitor (Asterisk 20 / PJSIP)  Filter: %s  Time: %s",
-           st.filter.c_str(), now_ts().c_str());
+static std::string selected_member(const std::vector<BridgeRow>& rows, const UiState& ui) {
+  if (rows.empty()) return "";
+  const auto& r = rows[std::max(0, std::min(ui.selected_bridge_index, (int)rows.size() - 1))];
+  if (r.member_channels.empty()) return "";
+  return r.member_channels[std::max(0, std::min(ui.selected_member_index, (int)r.member_channels.size() - 1))];
+}
 
-  mvprintw(1, 0, "Keys: [Up/Down]=Select Call  [Tab]=Select Member  [F]=Filter  [H]=Hangup Member  [K]=Kick Member  [B]=Destroy Bridge");
-  mvprintw(2, 0, "      [M]=Monitor (Originate supervisor to ChanSpy)  [L]=Logs  [Q]=Quit");
+// Start one pipelined job per node that has work. per_node[i] holds the actions for nodes[i].
+static void start_bulk_op(NodeList& nodes, UiState& ui, const std::string& label,
+                          std::vector<std::vector<AmiAction>> per_node) {
+  for (auto& j : ui.bulk_jobs) {
+    if (!j->reported) ui.bulk_older.push_back(j);
+  }
+  ui.bulk_jobs.clear();
+  for (size_t i = 0; i < nodes.size() && i < per_node.size(); i++) {
+    if (per_node[i].empty()) continue;
+    auto job = std::make_shared<BulkJob>();
+    job->label = label;
+    job->node_index = (int)i;
+    job->actions = std::move(per_node[i]);
+    nodes[i]->st.log_line("Bulk " + label + ": started, " + std::to_string(job->total()) + " actions");
+    nodes[i]->ami.start_bulk(job);
+    ui.bulk_jobs.push_back(std::move(job));
+  }
+}
 
-  auto rows = build_bridge_rows(st, cfg);
+// Log each finished bulk job once, with its timing
+static void report_bulk_jobs(NodeList& nodes, UiState& ui) {
+  auto report = [&](BulkJob& j) {
+    if (j.reported || !j.done.load()) return;
+    j.reported = true;
+    std::ostringstream oss;
+    oss << "Bulk " << j.label << ": " << j.ok.load() << " ok, " << j.failed.load() << " failed of "
+        << j.total() << " in " << j.elapsed_ms.load() << "ms";
+    nodes[j.node_index]->st.log_line(oss.str());
+  };
+  for (auto& j : ui.bulk_jobs) report(*j);
+  for (auto& j : ui.bulk_older) report(*j);
+  ui.bulk_older.erase(std::remove_if(ui.bulk_older.begin(), ui.bulk_older.end(),
+                                     [](const std::shared_ptr<BulkJob>& j) { return j->reported; }),
+                      ui.bulk_older.end());
+}
 
-  int list_start = 4;
-  mvprintw(list_start - 1, 0, "Calls (bridges): %d", (int)rows.size());
-  mvhline(list_start, 0, ACS_HLINE, maxx);
+// Emergency drop of every current call on peer: BridgeDestroy for each bridge it is in, then
+// Hangup for each of its channels (covers unbridged legs and anything that survives the bridge).
+static void mass_drop_peer(NodeList& nodes, UiState& ui, const std::string& peer) {
+  std::vector<std::vector<AmiAction>> per_node(nodes.size());
+  int channels = 0;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const StateStore& st = nodes[i]->st;
+    auto pit = st.channels_by_peer.find(peer);
+    if (pit == st.channels_by_peer.end()) continue;
+    std::set<std::string> bridges;
+    for (const auto& ch : pit->second) {
+      auto cit = st.channels_by_name.find(ch);
+      if (cit != st.channels_by_name.end() && !cit->second.bridge_id.empty()) bridges.insert(cit->second.bridge_id);
+    }
+    for (const auto& bid : bridges) per_node[i].push_back({"BridgeDestroy", {{"BridgeUniqueid", bid}}});
+    for (const auto& ch : pit->second) per_node[i].push_back({"Hangup", {{"Channel", ch}}});
+    channels += (int)pit->second.size();
+  }
+  if (channels == 0) return;
+  start_bulk_op(nodes, ui, "quarantine " + peer, std::move(per_node));
+}
 
-  int y = list_start + 1;
-  int idx = 0;
-  for (; idx < (int)rows.size() && y < maxy - 8; idx++, y++) {
-    const auto& r = rows[idx];
-    bool sel = (idx == st.selected_bridge_index);
-    if (sel) attron(A_REVERSE);
+// Recording group of the selected call: its queue if a member came through one, else its trunk.
+// Returns the label and the index to look members up in ("" if the call has neither).
+static std::string recording_group(const StateStore& st, const BridgeRow& sel, std::string& key, bool& by_queue) {
+  std::string trunk;
+  for (const auto& ch : sel.member_channels) {
+    auto it = st.channels_by_name.find(ch);
+    if (it == st.channels_by_name.end()) continue;
+    if (!it->second.queue.empty()) {
+      key = it->second.queue;
+      by_queue = true;
+      return "queue " + key;
+    }
+    if (trunk.empty() && it->second.is_trunk) trunk = it->second.peer;
+  }
+  if (trunk.empty()) return "";
+  key = trunk;
+  by_queue = false;
+  return "trunk " + key;
+}
 
-    std::ostringstream line;
-    line << std::setw(3) << idx + 1 << "  "
-         << std::setw(8) << (std::to_string(r.duration_sec) + "s") << "  "
-         << std::setw(9) << r.dir << "  "
-         << "parts=" << r.participants << "  "
-         << r.bridge_id.substr(0, 12) << "…  "
-         << r.summary;
+// Channels with a MixMonitor in c's call: c itself and its bridge peers
+static std::vector<std::string> recorded_legs(const StateStore& st, const ChannelInfo& c) {
+  std::vector<std::string> out;
+  if (!c.rec.empty()) out.push_back(c.channel);
+  auto bit = st.bridges.find(c.bridge_id);
+  if (bit == st.bridges.end()) return out;
+  for (const auto& ch : bit->second.channels) {
+    if (ch == c.channel) continue;
+    auto it = st.channels_by_name.find(ch);
+    if (it != st.channels_by_name.end() && !it->second.rec.empty()) out.push_back(ch);
+  }
+  return out;
+}
 
-    std::string s = line.str();
-    if ((int)s.size() > maxx - 1) s.resize(maxx - 1);
-    mvprintw(y, 0, "%s", s.c_str());
+// Start recording every call in the group, or stop them all if every one is already recording.
+// New recordings go on one channel per call: the queue caller or the trunk leg.
+static void bulk_record_group(NodeList& nodes, UiState& ui, const AppConfig& cfg, const BridgeRow& sel) {
+  std::string key;
+  bool by_queue = false;
+  std::string label = recording_group(nodes[sel.node_index]->st, sel, key, by_queue);
+  if (label.empty()) {
+    nodes[sel.node_index]->st.log_line("Record: selected call is not on a trunk or in a queue");
+    return;
+  }
 
-    if (sel) attroff(A_REVERSE);
+  std::vector<std::vector<AmiAction>> starts(nodes.size()), stops(nodes.size());
+  int total = 0, recording = 0;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const StateStore& st = nodes[i]->st;
+    const auto& index = by_queue ? st.channels_by_queue : st.channels_by_peer;
+    auto git = index.find(key);
+    if (git == index.end()) continue;
+    for (const auto& ch : git->second) {
+      auto cit = st.channels_by_name.find(ch);
+      if (cit == st.channels_by_name.end()) continue;
+      total++;
+      auto legs = recorded_legs(st, cit->second);
+      if (legs.empty()) {
+        starts[i].push_back(mixmonitor_action(cfg, ch, cit->second.uniqueid));
+        continue;
+      }
+      recording++;
+      for (const auto& leg : legs) stops[i].push_back(stop_mixmonitor_action(leg));
+    }
   }
+  if (total == 0) return;
 
-  // Selected call details
-  int detail_y = maxy - 7;
-  mvhline(detail_y - 1, 0, ACS_HLINE, maxx);
-  mvprintw(detail_y, 0, "Selected Call Details:");
+  bool stop = recording == total;
+  auto per_node = stop ? std::move(stops) : std::move(starts);
+  int n = stop ? total : total - recording;
+  if (!tui_confirm(std::string(stop ? "Stop" : "Start") + " recording " + std::to_string(n) + " calls on " + label + "?")) {
+    return;
+  }
+  start_bulk_op(nodes, ui, std::string(stop ? "stop recording " : "record ") + label, std::move(per_node));
+}
 
-  if (!rows.empty()) {
-    st.selected_bridge_index = std::max(0, std::min(st.selected_bridge_index, (int)rows.size() - 1));
-    const auto& sel = rows[st.selected_bridge_index];
+// Bring the enforced quarantine set in line with the TUI toggles and QUARANTINE_TRUNKS.
+// Newly quarantined peers get their current calls dropped; every node's reader gets the set.
+static void sync_quarantine(NodeList& nodes, UiState& ui, const AppConfig& cfg, AuditLog& log) {
+  std::set<std::string> next = ui.quarantine_manual;
+  next.insert(cfg.quarantine_trunks.begin(), cfg.quarantine_trunks.end());
+  if (next == ui.quarantine_active) return;
 
-    mvprintw(detail_y + 1, 0, "BridgeUniqueid: %s", sel.bridge_id.c_str());
-    mvprintw(detail_y + 2, 0, "Direction: %s   Duration: %ds   Participants: %d",
-             sel.dir.c_str(), sel.duration_sec, sel.participants);
+  for (const auto& peer : next) {
+    if (ui.quarantine_active.count(peer)) continue;
+    log.add("Quarantine ON: " + peer);
+    mass_drop_peer(nodes, ui, peer);
+  }
+  for (const auto& peer : ui.quarantine_active) {
+    if (!next.count(peer)) log.add("Quarantine OFF: " + peer);
+  }
+  ui.quarantine_active = next;
+  for (auto& n : nodes) n->ami.set_quarantine(next);
+}
 
-    mvprintw(detail_y + 3, 0, "Members:");
-    int my = detail_y + 4;
+// Originate supervisor into ChanSpy on target and start tracking the session
+static bool start_spy(PbxNode& node, const std::string& supervisor, const std::string& target, const std::string& mode,
+                      bool qa = false) {
+  static uint64_t seq = 0;
+  if (supervisor.empty()) return false;
+  std::string uid = "callmon-spy-" + std::to_string(std::time(nullptr)) + "-" + std::to_string(++seq);
+  SpySession sp;
+  try {
+    sp.originate_reply = node.ami.originate_supervisor_chanspy(supervisor, target, mode, uid, sp.originate_ticket);
+  } catch (const std::exception& ex) {
+    node.st.log_line("Monitor originate FAILED: " + supervisor + " -> " + target + " (" + ex.what() + ")");
+    return false;
+  }
+  sp.spy_uniqueid = uid;
+  sp.action_id = sp.originate_ticket.id;
+  sp.action_sent = std::chrono::steady_clock::now();
+  sp.supervisor = supervisor;
+  sp.target_channel = target;
+  sp.mode = mode;
+  sp.qa = qa;
+  node.st.spy_sessions[uid] = std::move(sp);
+  node.st.spy_by_target[target] = uid;
+  node.st.spy_by_supervisor[supervisor] = uid;
+  if (qa) node.st.qa_active++;
+  return true;
+}
 
-    int mindex = 0;
-    st.selected_member_index = std::max(0, std::min(st.selected_member_index, (int)sel.member_channels.size() - 1));
+// Hang up a session's supervisor leg. Before its Newchannel the leg is only known by the
+// ChannelId we gave it, which Asterisk's Hangup also accepts; if the channel does not exist yet,
+// spy_cancelled hangs it up when it appears.
+static void hangup_spy_leg(PbxNode& node, const SpySession& sp) {
+  if (!sp.spy_channel.empty()) {
+    node.ami.hangup_async(sp.spy_channel);
+    return;
+  }
+  node.st.spy_cancelled[sp.spy_uniqueid] = std::chrono::steady_clock::now();
+  node.ami.hangup_async(sp.spy_uniqueid, true); // fails when the leg does not exist yet
+}
 
-    for (; mindex < (int)sel.member_channels.size() && my < maxy - 1; mindex++, my++) {
-      const std::string& ch = sel.member_channels[mindex];
-      auto it = st.channels_by_name.find(ch);
+// Replace the supervisor's spy call with a fresh one in mode
+static void respawn_spy(PbxNode& node, std::string spy_uid, std::string mode, const std::string& why) {
+  auto it = node.st.spy_sessions.find(spy_uid);
+  if (it == node.st.spy_sessions.end()) return;
+  const SpySession& sp = it->second;
+  std::string supervisor = sp.supervisor, target = sp.target_channel;
+  bool qa = sp.qa;
+  hangup_spy_leg(node, sp);
+  end_spy_session(node.st, spy_uid, why);
+  start_spy(node, supervisor, target, mode, qa);
+}
 
-      std::ostringstream ml;
-      ml << (mindex == st.selected_member_index ? " > " : "   ")
-         << ch;
+// Ready reply; an Error once ACTION_TIMEOUT_MS has passed (the wait is cancelled and timed_out
+// set); nullopt while waiting
+static std::optional<AmiMessage> poll_reply(AmiClient& ami, std::future<AmiMessage>& f, const ActionTicket& t,
+                                            std::chrono::steady_clock::time_point sent,
+                                            std::chrono::steady_clock::time_point now, const AppConfig& cfg,
+                                            bool& timed_out) {
+  timed_out = false;
+  if (f.wait_for(std::chrono::seconds(0)) == std::future_status::ready) return f.get();
+  if (now - sent < std::chrono::milliseconds(cfg.action_timeout_ms)) return std::nullopt;
+  ami.cancel(t);
+  f = {};
+  timed_out = true;
+  AmiMessage err;
+  err.kv["Response"] = "Error";
+  err.kv["Message"] = "no response";
+  return err;
+}
 
-      if (it != st.channels_by_name.end()) {
-        const auto& c = it->second;
-        std::string d = classify_dir_heuristic(c, cfg);
-        ml << "  [" << d << "]"
-           << "  CID:" << (c.caller_num.empty() ? "?" : c.caller_num)
-           << "  CONN:" << (c.connected_num.empty() ? "?" : c.connected_num)
-           << "  STATE:" << (c.state_desc.empty() ? "?" : c.state_desc);
+// Responses to monitor Originate/Redirect actions, which are sent without blocking the UI
+static void poll_spy_actions(NodeList& nodes, const AppConfig& cfg) {
+  auto now = std::chrono::steady_clock::now();
+  for (auto& n : nodes) {
+    StateStore& st = n->st;
+    std::vector<std::string> waiting;
+    for (auto& [uid, sp] : st.spy_sessions) {
+      if (sp.originate_reply.valid() || sp.redirect_reply.valid()) waiting.push_back(uid);
+    }
+    for (const auto& uid : waiting) {
+      auto it = st.spy_sessions.find(uid);
+      if (it == st.spy_sessions.end()) continue;
+      SpySession& sp = it->second;
+      bool timed_out = false;
+      if (sp.originate_reply.valid()) {
+        auto r = poll_reply(n->ami, sp.originate_reply, sp.originate_ticket, sp.action_sent, now, cfg, timed_out);
+        if (!r) continue;
+        if (lower(r->kv["Response"]) == "success") {
+          st.log_line(std::string(sp.qa ? "QA monitor" : "Monitor") + " originate OK: " + sp.supervisor + " -> " +
+                      sp.target_channel + " " + sp.mode + " (awaiting answer)");
+        } else {
+          st.log_line("Monitor originate FAILED: " + sp.supervisor + " -> " + sp.target_channel + " (" +
+                      std::string(r->kv["Message"]) + ")");
+          // Unanswered, the Originate may still have gone through
+          if (timed_out) hangup_spy_leg(*n, sp);
+          end_spy_session(st, uid, "originate rejected");
+        }
+        continue;
+      }
+      auto r = poll_reply(n->ami, sp.redirect_reply, sp.redirect_ticket, sp.action_sent, now, cfg, timed_out);
+      if (!r) continue;
+      if (lower(r->kv["Response"]) == "success") {
+        st.log_line("Monitor " + sp.supervisor + " -> " + sp.target_channel + " switched " + sp.mode + " -> " +
+                    sp.redirect_mode);
+        sp.mode = sp.redirect_mode;
+        sp.state = "answered";
+      } else {
+        st.log_line("Monitor: Redirect failed, re-originating " + sp.supervisor + " in " + sp.redirect_mode);
+        respawn_spy(*n, uid, sp.redirect_mode, "switching to " + sp.redirect_mode);
       }
+    }
 
-      std::string ms = ml.str();
-      if ((int)ms.size() > maxx - 1) ms.resize(maxx - 1);
-      mvprintw(my, 0, "%s", ms.c_str());
+    for (auto it = st.spy_cancelled.begin(); it != st.spy_cancelled.end();) {
+      bool expired = now - it->second > std::chrono::milliseconds(cfg.originate_timeout_ms) + std::chrono::seconds(10);
+      it = expired ? st.spy_cancelled.erase(it) : std::next(it);
     }
-  } else {
-    mvprintw(detail_y + 1, 0, "No active bridges detected. Ensure calls are being bridged and AMI events are enabled.");
   }
-
-  refresh();
 }
 
-static void tui_show_logs(StateStore& st) {
-  erase();
-  int maxy, maxx;
-  getmaxyx(stdscr, maxy, maxx);
-
-  mvprintw(0, 0, "Audit / Event Log (press any key to return)");
-  mvhline(1, 0, ACS_HLINE, maxx);
+// Start monitoring target in mode, or switch the supervisor's existing session on target to mode.
+// A supervisor has at most one spy call: a request for a different target is refused.
+static void monitor_target(PbxNode& node, const std::string& supervisor, const std::string& target, const std::string& mode) {
+  StateStore& st = node.st;
+  auto sup = st.spy_by_supervisor.find(supervisor);
+  if (sup != st.spy_by_supervisor.end() && !st.spy_sessions.count(sup->second)) {
+    // Stale index entry: drop it and start fresh rather than acting on an empty session
+    st.spy_by_supervisor.erase(sup);
+    sup = st.spy_by_supervisor.end();
+  }
+  if (sup == st.spy_by_supervisor.end()) {
+    if (st.spy_by_target.count(target)) {
+      st.log_line("Monitor: " + target + " is already being monitored");
+      return;
+    }
+    start_spy(node, supervisor, target, mode);
+    return;
+  }
+  SpySession& sp = st.spy_sessions.find(sup->second)->second;
+  if (sp.target_channel != target) {
+    st.log_line("Monitor: " + supervisor + " is already on " + sp.target_channel + " (press 0 there to end it first)");
+    return;
+  }
+  if (sp.redirect_reply.valid()) {
+    st.log_line("Monitor: " + supervisor + " is already switching to " + sp.redirect_mode);
+    return;
+  }
+  if (sp.mode == mode) return;
 
-  int start = std::max(0, (int)st.audit_log.size() - (maxy - 3));
-  int y = 2;
-  for (int i = start; i < (int)st.audit_log.size() && y < maxy; i++, y++) {
-    std::string s = st.audit_log[i];
-    if ((int)s.size() > maxx - 1) s.resize(maxx - 1);
-    mvprintw(y, 0, "%s", s.c_str());
+  // Answered leg: redirect it into the other ChanSpy variant, no re-ring. Otherwise re-originate.
+  if ((sp.state == "answered" || sp.state == "spying") && !sp.spy_channel.empty()) {
+    try {
+      sp.redirect_reply = node.ami.redirect_supervisor_chanspy(sp.spy_channel, target, mode, sp.redirect_ticket);
+      sp.redirect_mode = mode;
+      sp.action_sent = std::chrono::steady_clock::now();
+      return;
+    } catch (const std::exception& ex) {
+      st.log_line("Monitor: Redirect not sent (" + std::string(ex.what()) + "), re-originating " + supervisor + " in " + mode);
+    }
   }
-  refresh();
-  getch();
+  respawn_spy(node, sup->second, mode, "switching to " + mode);
 }
 
-static void signal_handler(int) {
-  g_running.store(false);
+static void end_monitor(PbxNode& node, const std::string& target) {
+  auto tit = node.st.spy_by_target.find(target);
+  if (tit == node.st.spy_by_target.end()) return;
+  auto sit = node.st.spy_sessions.find(tit->second);
+  if (sit == node.st.spy_sessions.end()) return;
+  hangup_spy_leg(node, sit->second);
+  end_spy_session(node.st, sit->first, "ended by operator");
 }
 
-static AppConfig read_config_from_env_and_args(int argc, char** argv) {
-  AppConfig cfg;
+#ifdef CALLMON_COUNT_ALLOCS
+// --alloc-selftest: replay canned AMI frames through read_message, EventBatch and apply_event over a
+// loopback socket and check the steady-state heap allocations per event. The setup frames create
+// the channels; the measured rounds only update them, as on a busy PBX between calls.
+static int alloc_self_test() {
+  constexpr int kChannels = 50, kWarmup = 2, kRounds = 20;
+  boost::asio::io_context io;
+  tcp::acceptor acc(io, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+  AmiConn conn(io);
+  conn.socket.connect(acc.local_endpoint());
+  tcp::socket peer = acc.accept();
+  ConfigStore conf{AppConfig{}};
+  AmiClient ami(io, conf, AmiNodeConfig{});
+  auto cfg = conf.get();
+  StateStore st;
+  EventBatch batch;
 
-  // CLI: host port user secret
-  if (argc >= 3) { cfg.ami_host = argv[1]; cfg.ami_port = std::stoi(argv[2]); }
-  if (argc >= 4) cfg.ami_user = argv[3];
-  if (argc >= 5) cfg.ami_secret = argv[4];
+  std::string setup, round;
+  int per_round = 0;
+  for (int i = 0; i < kChannels; i++) {
+    std::string n = std::to_string(1000 + i);
+    std::string ch = "PJSIP/" + n + "-000000" + std::to_string(10 + i), uid = "1700000000." + std::to_string(i);
+    setup += "Event: Newchannel\r\nPrivilege: call,all\r\nChannel: " + ch +
+             "\r\nChannelState: 4\r\nChannelStateDesc: Ring\r\nCallerIDNum: " + n +
+             "\r\nCallerIDName: Agent " + n + "\r\nContext: from-internal\r\nExten: 5551234\r\nPriority: 1"
+             "\r\nUniqueid: " + uid + "\r\nLinkedid: " + uid + "\r\n\r\n";
+    round += "Event: Newstate\r\nPrivilege: call,all\r\nChannel: " + ch +
+             "\r\nChannelState: 6\r\nChannelStateDesc: Up\r\nUniqueid: " + uid + "\r\nLinkedid: " + uid + "\r\n\r\n";
+    round += "Event: Newexten\r\nPrivilege: dialplan,all\r\nChannel: " + ch +
+             "\r\nContext: from-internal\r\nExtension: 5551234\r\nPriority: 2\r\nApplication: Dial"
+             "\r\nAppData: PJSIP/trunk/5551234,60\r\nUniqueid: " + uid + "\r\nLinkedid: " + uid + "\r\n\r\n";
+    round += "Event: VarSet\r\nPrivilege: dialplan,all\r\nChannel: " + ch +
+             "\r\nVariable: DIALSTATUS\r\nValue: ANSWER\r\nUniqueid: " + uid + "\r\nLinkedid: " + uid + "\r\n\r\n";
+    round += "Event: DeviceStateChange\r\nPrivilege: call,all\r\nDevice: PJSIP/" + n + "\r\nState: INUSE\r\n\r\n";
+    per_round += 4;
+  }
 
-  auto getenv_s = [](const char* k) -> std::string {
-    const char* v = std::getenv(k);
-    return v ? std::string(v) : "";
+  alignas(std::max_align_t) std::byte scratch_buf[16 * 1024];
+  std::pmr::monotonic_buffer_resource scratch(scratch_buf, sizeof(scratch_buf));
+  uint64_t parse = 0, apply = 0;
+  auto replay = [&](const std::string& frames, int count) {
+    boost::asio::write(peer, boost::asio::buffer(frames));
+    parse = apply = 0;
+    for (int i = 0; i < count; i++) {
+      scratch.release();
+      uint64_t a0 = t_heap_allocs;
+      AmiMessage msg(&scratch);
+      ami.read_message(conn, msg);
+      batch.push(msg);
+      parse += t_heap_allocs - a0;
+    }
+    uint64_t a1 = t_heap_allocs;
+    for (const auto& m : batch.messages()) apply_event(st, *cfg, m);
+    st.devices.commit(std::chrono::steady_clock::now());
+    batch.reset();
+    apply += t_heap_allocs - a1;
   };
 
-  // Allow env overrides (used by systemd EnvironmentFile)
-  if (!getenv_s("AMI_HOST").empty()) cfg.ami_host = getenv_s("AMI_HOST");
-  if (!getenv_s("AMI_PORT").empty()) cfg.ami_port = std::stoi(getenv_s("AMI_PORT"));
-  if (!getenv_s("AMI_USER").empty()) cfg.ami_user = getenv_s("AMI_USER");
-  if (!getenv_s("AMI_SECRET").empty()) cfg.ami_secret = getenv_s("AMI_SECRET");
-
-  if (!getenv_s("SUPERVISOR_ENDPOINT").empty()) cfg.supervisor_endpoint = getenv_s("SUPERVISOR_ENDPOINT");
-  if (!getenv_s("SUPERVISOR_CONTEXT").empty()) cfg.supervisor_context = getenv_s("SUPERVISOR_CONTEXT");
-  if (!getenv_s("SUPERVISOR_PREFIX").empty()) cfg.supervisor_prefix = getenv_s("SUPERVISOR_PREFIX");
-  if (!getenv_s("ORIGINATE_TIMEOUT_MS").empty()) cfg.originate_timeout_ms = std::stoi(getenv_s("ORIGINATE_TIMEOUT_MS"));
-
-  return cfg;
+  replay(setup, kChannels);
+  for (int r = 0; r < kWarmup; r++) replay(round, per_round);
+  uint64_t parse_total = 0, apply_total = 0;
+  for (int r = 0; r < kRounds; r++) {
+    replay(round, per_round);
+    parse_total += parse;
+    apply_total += apply;
+  }
+  double events = (double)kRounds * per_round;
+  std::cout << std::fixed << std::setprecision(3) << "alloc self-test: " << (int)events
+            << " events, read " << parse_total / events << " allocs/event, apply " << apply_total / events
+            << " allocs/event\n";
+  // Reading must not allocate once the buffers have grown; applying updates may only grow the
+  // call timelines now and then
+  bool ok = parse_total == 0 && apply_total / events < 0.05;
+  std::cout << (ok ? "PASS" : "FAIL") << "\n";
+  return ok ? 0 : 1;
 }
+#endif
 
 int main(int argc, char** argv) {
+#ifdef CALLMON_COUNT_ALLOCS
+  if (argc == 2 && std::string(argv[1]) == "--alloc-selftest") return alloc_self_test();
+#endif
   std::signal(SIGINT, signal_handler);
   std::signal(SIGTERM, signal_handler);
+  std::signal(SIGHUP, sighup_handler);
 
-  AppConfig cfg = read_config_from_env_and_args(argc, argv);
-  if (cfg.ami_user.empty() || cfg.ami_secret.empty()) {
+  AppConfig initial;
+  try {
+    initial = read_config_from_env_and_args(argc, argv);
+  } catch (const std::exception& ex) {
+    std::cerr << "Invalid configuration: " << ex.what() << "\n";
+    return 1;
+  }
+  if (initial.ami_user.empty() || initial.ami_secret.empty()) {
     std::cerr << "Usage: " << argv[0] << " <host> <port> <user> <secret>\n"
-              << "Or set AMI_HOST/AMI_PORT/AMI_USER/AMI_SECRET in environment.\n";
+              << "Or set AMI_HOST/AMI_PORT/AMI_USER/AMI_SECRET in environment or in CALLMON_CONFIG.\n";
     return 1;
   }
+  ConfigStore conf(std::move(initial));
 
   boost::asio::io_context io;
-  AmiClient ami(io, cfg);
-
-  std::deque<AmiMessage> q;
-  std::mutex q_mu;
+  AuditLog audit;
+  audit.add("Starting...");
 
-  StateStore st;
-  st.log_line("Starting...");
+  auto node_cfgs = effective_nodes(*conf.get());
+  NodeList nodes;
+  for (const auto& nc : node_cfgs) {
+    auto n = std::make_unique<PbxNode>(io, conf, nc);
+    n->st.node = nc.name;
+    n->st.tag_log = node_cfgs.size() > 1;
+    n->st.audit = &audit;
+    nodes.push_back(std::move(n));
+  }
 
-  try {
-    ami.connect();
-    if (!ami.login()) {
-      std::cerr << "AMI login failed.\n";
-      return 1;
+  // A node that is down at startup is shown as DOWN; only give up if none can be reached
+  int up = 0;
+  for (auto& n : nodes) {
+    try {
+      n->ami.connect();
+      if (!n->ami.login()) {
+        std::cerr << "AMI login failed (" << n->st.node << ").\n";
+        continue;
+      }
+      n->st.log_line("AMI login success");
+      if (n->ami.has_action_lane()) n->st.log_line("AMI action connection ready (Events: off)");
+      if (n->ami.action_lane_failed()) n->st.log_line("AMI action connection failed, sending actions on the event connection");
+      n->ami.start_reader(&n->batch, &n->q_mu);
+      // Current contact states; ContactStatus events only report changes
+      try {
+        n->ami.send_action({"PJSIPShowContacts", {}});
+      } catch (const std::exception& ex) {
+        n->st.log_line(std::string("PJSIPShowContacts not sent: ") + ex.what());
+      }
+      up++;
+    } catch (const std::exception& ex) {
+      std::cerr << "Connection/login error (" << n->st.node << "): " << ex.what() << "\n";
+      n->st.log_line(std::string("Connection/login error: ") + ex.what());
     }
-    st.log_line("AMI login success");
-  } catch (const std::exception& ex) {
-    std::cerr << "Connection/login error: " << ex.what() << "\n";
-    return 1;
   }
-
-  ami.start_reader(&q, &q_mu);
+  if (up == 0) return 1;
+  // Nodes that failed above retry in the background with the same backoff as a dropped session
+  for (auto& n : nodes) {
+    if (!n->ami.connected()) n->ami.start_reader(&n->batch, &n->q_mu, true);
+  }
 
   // Init TUI
   initscr();
@@ -737,19 +4832,69 @@ int main(int argc, char** argv) {
   nodelay(stdscr, TRUE); // non-blocking
   curs_set(0);
 
-  bool show_logs = false;
+  UiState ui;
+  sync_quarantine(nodes, ui, *conf.get(), audit);
   while (g_running.load()) {
-    // Drain event queue
+    if (g_reload.exchange(false)) {
+      reload_config(conf, nodes, audit);
+      sync_quarantine(nodes, ui, *conf.get(), audit);
+    }
+    for (auto& n : nodes) {
+      for (const auto& line : n->ami.drain_notes()) n->st.log_line(line);
+    }
+
+    // Drain each node's event queue into its own shard, against one config snapshot
     {
-      std::lock_guard<std::mutex> lk(q_mu);
-      while (!q.empty()) {
-        auto msg = std::move(q.front());
-        q.pop_front();
-        apply_event(st, cfg, msg);
+      auto cfg = conf.get();
+      for (auto& n : nodes) {
+        std::lock_guard<std::mutex> lk(n->q_mu);
+        if (n->batch.size()) {
+          uint64_t allocs = t_heap_allocs;
+          for (const auto& msg : n->batch.messages()) apply_event(n->st, *cfg, msg);
+          n->batch.note_applied(n->batch.size(), t_heap_allocs - allocs, std::chrono::steady_clock::now());
+          n->batch.reset();
+        }
+        n->st.devices.commit(std::chrono::steady_clock::now());
+      }
+      // Follow-up actions decided while applying events
+      for (auto& n : nodes) {
+        for (const auto& a : n->st.outbox) {
+          try {
+            n->ami.send_action(a);
+          } catch (const std::exception& ex) {
+            n->st.log_line("Action " + a.name + " not sent: " + ex.what());
+          }
+        }
+        n->st.outbox.clear();
+      }
+      // QA samples picked while applying events
+      for (auto& n : nodes) {
+        for (const auto& p : n->st.qa_picks) {
+          n->st.qa_reserved.erase(p.supervisor);
+          if (!n->st.channels_by_name.count(p.target) || n->st.spy_by_target.count(p.target)) continue;
+          start_spy(*n, p.supervisor, p.target, "listen", true);
+        }
+        n->st.qa_picks.clear();
       }
     }
 
-    tui_draw(st, cfg);
+    report_bulk_jobs(nodes, ui);
+    sample_taskprocessors(nodes, *conf.get());
+    fetch_codec_formats(nodes, *conf.get());
+    resync_channels(nodes, *conf.get());
+    heartbeat(nodes, *conf.get());
+    poll_spy_actions(nodes, *conf.get());
+    // Secondary views redraw live, so events keep being applied while they are open
+    if (ui.view == "logs") tui_show_logs(audit);
+    else if (ui.view == "stats") tui_show_stats(nodes, *conf.get());
+    else if (ui.view == "profile") tui_show_profile(nodes, *conf.get());
+    else if (ui.view == "taskprocs") tui_show_taskprocs(nodes, *conf.get());
+    else if (ui.view == "endpoints") tui_show_endpoints(nodes, ui);
+    else if (ui.view == "devices") tui_show_devices(nodes);
+    else if (ui.view == "causes") tui_show_causes(nodes, *conf.get());
+    else if (ui.view == "history") tui_show_history(nodes, ui);
+    else if (ui.view == "timeline") tui_show_timeline(nodes, ui);
+    else tui_draw(nodes, ui);
 
     int ch = getch();
     if (ch == ERR) {
@@ -757,23 +4902,238 @@ int main(int argc, char** argv) {
       continue;
     }
 
+    if (ui.view == "endpoints" && (ch == 'o' || ch == 'O')) {
+      ui.endpoint_sort = ui.endpoint_sort == "rtt" ? "flaps" : ui.endpoint_sort == "flaps" ? "name" : "rtt";
+      continue;
+    }
+    if (ui.view != "calls") {
+      // any key returns to the call list
+      ui.view = "calls";
+      continue;
+    }
+
     if (ch == 'q' || ch == 'Q') {
       g_running.store(false);
       break;
     }
 
     if (ch == 'l' || ch == 'L') {
-      // Temporarily turn off nodelay so log view can block
-      nodelay(stdscr, FALSE);
-      tui_show_logs(st);
-      nodelay(stdscr, TRUE);
+      ui.view = "logs";
+      continue;
+    }
+
+    if (ch == 's' || ch == 'S') {
+      ui.view = "stats";
+      continue;
+    }
+
+    if (ch == 'p' || ch == 'P') {
+      ui.view = "profile";
+      continue;
+    }
+
+    if (ch == 'y' || ch == 'Y') {
+      ui.view = "taskprocs";
+      continue;
+    }
+
+    if (ch == 'e' || ch == 'E') {
+      ui.view = "endpoints";
+      continue;
+    }
+
+    if (ch == 'd' || ch == 'D') {
+      ui.view = "devices";
+      continue;
+    }
+
+    if (ch == 'c' || ch == 'C') {
+      ui.view = "causes";
       continue;
     }
 
     if (ch == 'f' || ch == 'F') {
       // cycle filters
-      std::string f = lower(st.filter);
-      if (f == "all") st.filter = "inbound";
-      else if (f == "inbound") st.filter = "outbound";
-      else if (f == "outbound") st.filter = "internal";
-      else st.filter = "all";
+      std::string f = lower(ui.filter);
+      if (f == "all") ui.filter = "inbound";
+      else if (f == "inbound") ui.filter = "outbound";
+      else if (f == "outbound") ui.filter = "internal";
+      else ui.filter = "all";
+      ui.selected_bridge_index = 0;
+      ui.selected_member_index = 0;
+      continue;
+    }
+
+    if (ch == 'o' || ch == 'O') {
+      // cycle sort order
+      if (ui.sort == "duration") ui.sort = "node";
+      else if (ui.sort == "node") ui.sort = "direction";
+      else if (ui.sort == "direction") ui.sort = "parts";
+      else ui.sort = "duration";
+      ui.selected_bridge_index = 0;
+      ui.selected_member_index = 0;
+      continue;
+    }
+
+    if (ch == KEY_UP) {
+      ui.selected_bridge_index = std::max(0, ui.selected_bridge_index - 1);
+      ui.selected_member_index = 0;
+      continue;
+    }
+
+    if (ch == KEY_DOWN) {
+      ui.selected_bridge_index++; // clamped in tui_draw
+      ui.selected_member_index = 0;
+      continue;
+    }
+
+    auto rows = build_bridge_rows(nodes, ui);
+    if (rows.empty()) continue;
+
+    if (ch == 'x' || ch == 'X') {
+      // Hang up every member of every call in the current filter, pipelined per node
+      std::vector<std::vector<AmiAction>> per_node(nodes.size());
+      int count = 0;
+      for (const auto& r : rows) {
+        for (const auto& m : r.member_channels) {
+          per_node[r.node_index].push_back({"Hangup", {{"Channel", m}}});
+          count++;
+        }
+      }
+      if (!tui_confirm("Hang up " + std::to_string(count) + " channels in " + std::to_string(rows.size()) +
+                       " calls (filter: " + ui.filter + ")?")) continue;
+      start_bulk_op(nodes, ui, "hangup filter=" + ui.filter, std::move(per_node));
+      continue;
+    }
+
+    const auto& sel = rows[std::max(0, std::min(ui.selected_bridge_index, (int)rows.size() - 1))];
+    PbxNode& node = *nodes[sel.node_index];
+
+    if (ch == '\t') {
+      if (!sel.member_channels.empty()) {
+        ui.selected_member_index = (ui.selected_member_index + 1) % (int)sel.member_channels.size();
+      }
+      continue;
+    }
+
+    std::string member = selected_member(rows, ui);
+
+    if (ch == 'i' || ch == 'I') {
+      auto cit = node.st.channels_by_name.find(member);
+      if (cit == node.st.channels_by_name.end() || cit->second.linkedid.empty()) continue;
+      ui.history_node = sel.node_index;
+      ui.timeline_linkedid = cit->second.linkedid;
+      ui.view = "timeline";
+      continue;
+    }
+
+    if (ch == '\n' || ch == '\r' || ch == KEY_ENTER) {
+      if (member.empty()) continue;
+      ui.history_node = sel.node_index;
+      ui.history_channel = member;
+      ui.view = "history";
+      continue;
+    }
+
+    if (ch == 'h' || ch == 'H') {
+      if (member.empty()) continue;
+      bool ok = node.ami.hangup_channel(member);
+      node.st.log_line(std::string("Hangup ") + (ok ? "OK: " : "FAILED: ") + member);
+      continue;
+    }
+
+    if (ch == 'k' || ch == 'K') {
+      if (member.empty()) continue;
+      bool ok = node.ami.bridge_kick(sel.bridge_id, member);
+      node.st.log_line(std::string("BridgeKick ") + (ok ? "OK: " : "FAILED: ") + member + " from " + sel.bridge_id);
+      continue;
+    }
+
+    if (ch == 'b' || ch == 'B') {
+      bool ok = node.ami.bridge_destroy(sel.bridge_id);
+      node.st.log_line(std::string("BridgeDestroy ") + (ok ? "OK: " : "FAILED: ") + sel.bridge_id);
+      continue;
+    }
+
+    if (ch == 't' || ch == 'T') {
+      if (member.empty()) continue;
+      auto cit = node.st.channels_by_name.find(member);
+      if (cit == node.st.channels_by_name.end() || cit->second.peer.empty()) continue;
+      const std::string peer = cit->second.peer;
+      auto cfg = conf.get();
+      if (std::find(cfg->quarantine_trunks.begin(), cfg->quarantine_trunks.end(), peer) != cfg->quarantine_trunks.end()) {
+        audit.add("Quarantine " + peer + " is set in QUARANTINE_TRUNKS; edit the config and reload to lift it");
+        continue;
+      }
+      if (ui.quarantine_manual.count(peer)) {
+        if (!tui_confirm("Lift quarantine on trunk " + peer + "?")) continue;
+        ui.quarantine_manual.erase(peer);
+      } else {
+        int active = 0;
+        for (const auto& n : nodes) {
+          auto pit = n->st.channels_by_peer.find(peer);
+          if (pit != n->st.channels_by_peer.end()) active += (int)pit->second.size();
+        }
+        if (!tui_confirm("QUARANTINE trunk " + peer + ": drop " + std::to_string(active) +
+                         " active channels and hang up every new one?")) continue;
+        ui.quarantine_manual.insert(peer);
+      }
+      sync_quarantine(nodes, ui, *cfg, audit);
+      continue;
+    }
+
+    if (ch == 'r' || ch == 'R' || ch == 'u' || ch == 'U') {
+      if (member.empty()) continue;
+      auto cit = node.st.channels_by_name.find(member);
+      if (cit == node.st.channels_by_name.end()) continue;
+      const ChannelInfo& c = cit->second;
+      bool ok;
+      std::string what;
+      if (ch == 'r' || ch == 'R') {
+        what = c.rec.empty() ? "MixMonitor" : "StopMixMonitor";
+        ok = c.rec.empty() ? node.ami.start_recording(member, c.uniqueid) : node.ami.stop_recording(member);
+      } else {
+        if (c.rec.empty()) continue;
+        bool pause = c.rec != "paused";
+        what = pause ? "Recording pause" : "Recording resume";
+        ok = node.ami.pause_recording(member, pause);
+        // Older Asterisk sends no MixMonitorMute event; the response is all we get
+        if (ok) cit->second.rec = pause ? "paused" : "recording";
+      }
+      node.st.log_line(what + (ok ? " OK: " : " FAILED: ") + member);
+      continue;
+    }
+
+    if (ch == 'a' || ch == 'A') {
+      bulk_record_group(nodes, ui, *conf.get(), sel);
+      continue;
+    }
+
+    if (ch == 'm' || ch == 'M' || ch == '1' || ch == '2' || ch == '3') {
+      if (member.empty()) continue;
+      if (conf.get()->supervisor_endpoint.empty()) {
+        node.st.log_line("Monitor: SUPERVISOR_ENDPOINT not configured");
+        continue;
+      }
+      std::string mode = ch == '2' ? "whisper" : ch == '3' ? "barge" : "listen";
+      monitor_target(node, conf.get()->supervisor_endpoint, member, mode);
+      continue;
+    }
+
+    if (ch == '0') {
+      if (!member.empty()) end_monitor(node, member);
+      continue;
+    }
+  }
+
+  endwin();
+  for (auto& n : nodes) {
+    if (!n->ami.connected()) continue;
+    try {
+      n->ami.logoff(); // Asterisk closes the socket, which ends the reader thread
+    } catch (...) {
+    }
+  }
+  for (auto& n : nodes) n->ami.stop_reader();
+  return 0;
+}